@@ -66,6 +66,15 @@ WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.  */
 #define OPERATION_CLEAR  (0)
 #define OPERATION_SET    (1)
 #define OPERATION_NONE   (2)
+/**
+ *  Non-zero on boards where setPWMFrequency() knows the timer registers:
+ *  the ATmega168/328 of the Uno and similar boards.
+ */
+#if WMS_ENABLE_PWM_CONFIG && (defined(__AVR_ATmega328P__) || defined(__AVR_ATmega328__) || defined(__AVR_ATmega168__))
+#define PWM_TIMER_CONFIG (1)
+#else
+#define PWM_TIMER_CONFIG (0)
+#endif
 /**
  *  Contains direction and brake status for motors
  *  #M1, #M2, #M3, and #M4.
@@ -82,6 +91,7 @@ uint8_t WickedMotorShield::second_shift_register = 0xff;
  *  Pin 12 for standard pins, pin 0 for alternate pins.
  */
 uint8_t WickedMotorShield::SERIAL_DATA_PIN = 12;
+#if WMS_ENABLE_RCIN
 /**
  *   Digital pin used for Radio Control Input Pin 1.
  *
@@ -94,6 +104,7 @@ uint8_t WickedMotorShield::RCIN1_PIN = 4;
  *  Pin 8 used for standard pins, pin 11 for alternate pins.
  */
 uint8_t WickedMotorShield::RCIN2_PIN = 8;
+#endif
 /**
  * Digital pin for M1 PWM (pulse width modulation).
  *
@@ -113,9 +124,127 @@ uint8_t WickedMotorShield::M6_PWM_PIN = 3;
  *  When the brake bit is changed from 0 to 1, the
  *  direction bit indicates whether it is BRAKE_SOFT or
  *  BRAKE_HARD.  If the direction bit wasn't copied to
- *  this array, the value would be lost.
+ *  this array, the value would be lost.  The initial direction coming
+ *  out of brake is clockwise.
+ */
+uint8_t WickedMotorShield::old_dir[6] = {DIR_CW,DIR_CW,DIR_CW,DIR_CW,DIR_CW,DIR_CW};
+/**
+ *  Non-zero once begin() has set up the pins.
+ */
+uint8_t WickedMotorShield::initialized = 0;
+#if WMS_TRACE_DEPTH > 0
+/**
+ *  Ring of the most recent shift register loads and PWM changes.
+ */
+WickedTraceEvent WickedMotorShield::trace_buffer[WMS_TRACE_DEPTH];
+/**
+ *  Index in WickedMotorShield#trace_buffer of the next event to write.
+ */
+uint8_t WickedMotorShield::trace_head = 0;
+/**
+ *  Non-zero once WickedMotorShield#trace_buffer has been filled and older
+ *  events are being overwritten.
+ */
+uint8_t WickedMotorShield::trace_wrapped = 0;
+/**
+ *  Non-zero once setPWMFrequency() has reconfigured Timer0, whose counts
+ *  then no longer measure time; trace events are stamped with micros().
+ */
+uint8_t WickedMotorShield::trace_micros = 0;
+#endif
+#if WMS_RCIN_CAPTURE
+/**
+ *  Input register and bit mask of RCIN1 and RCIN2, read by the pin change
+ *  interrupt.
+ */
+volatile uint8_t * WickedMotorShield::rc_input_reg[2];
+uint8_t WickedMotorShield::rc_input_mask[2];
+/**
+ *  Level of each RC input at the last interrupt, bit 0 for RCIN1.
+ */
+uint8_t WickedMotorShield::rc_level = 0;
+/**
+ *  Bit 0 (RCIN1) or bit 1 (RCIN2) set once a rising edge has been timed,
+ *  so a pulse already high when capture started is not measured.
+ */
+uint8_t WickedMotorShield::rc_rise_seen = 0;
+/**
+ *  micros() at the last rising edge of each RC input.
+ */
+uint32_t WickedMotorShield::rc_rise_time[2];
+/**
+ *  Width in microseconds of the last complete pulse on each RC input.
+ */
+volatile uint16_t WickedMotorShield::rc_width[2] = {0, 0};
+/**
+ *  Bit 0 (RCIN1) or bit 1 (RCIN2) set when a pulse completed since the
+ *  last newRCINFrame() that returned 1.
+ */
+volatile uint8_t WickedMotorShield::rc_fresh = 0;
+#endif
+#if WMS_ENABLE_ENCODER
+/**
+ *  Encoders attached with Wicked_DCMotor::attachEncoder(), decoded by the
+ *  pin change interrupt.  A slot is free while its mask_a is 0.
+ */
+WickedEncoder WickedMotorShield::encoders[WMS_ENCODER_COUNT];
+/**
+ *  Position change for a quadrature transition, indexed by
+ *  (old_state << 2) | new_state with state = (A << 1) | B.  Transitions
+ *  that change both channels were missed edges and count as 0.
+ */
+const int8_t WickedMotorShield::quadrature_table[16] = {
+   0, -1,  1,  0,
+   1,  0,  0, -1,
+  -1,  0,  0,  1,
+   0,  1, -1,  0
+};
+#endif
+#if WMS_ENABLE_CURRENT_SENSE
+/**
+ *  Number of extra bits of current sense resolution requested for each
+ *  motor.  4^n samples are summed and shifted right by n.
+ */
+uint8_t WickedMotorShield::oversample_bits[6] = {0,0,0,0,0,0};
+/**
+ *  Samples per second achieved by the most recent oversampled current
+ *  reading of each motor.
  */
-uint8_t WickedMotorShield::old_dir[6] = {0,0,0,0,0,0};
+uint16_t WickedMotorShield::sample_rate[6] = {0,0,0,0,0,0};
+/**
+ *  Longest time in microseconds an oversampled current reading may take.
+ *  0 means no limit.
+ */
+uint16_t WickedMotorShield::sense_budget_us = 0;
+/**
+ *  Measured duration of one analogRead() in microseconds.  Starts at the
+ *  value for the default 125 kHz ADC clock and is refined on every
+ *  oversampled reading.
+ */
+uint8_t WickedMotorShield::adc_conversion_us = 112;
+#endif
+#if WMS_ENABLE_PWM_CONFIG
+/**
+ *  TOP value of Timer0, Timer1 and Timer2 after setPWMFrequency(), or 0
+ *  while the timer is left as analogWrite() configures it.
+ */
+uint16_t WickedMotorShield::pwm_top[3] = {0, 0, 0};
+/**
+ *  Carrier frequency in Hz of Timer0, Timer1 and Timer2 after
+ *  setPWMFrequency().
+ */
+uint32_t WickedMotorShield::pwm_frequency[3] = {0, 0, 0};
+#endif
+#if WMS_ENABLE_DCMOTOR && WMS_ENABLE_BEMF
+/**
+ *  Number of Wicked_DCMotor objects with back-EMF speed estimation enabled.
+ */
+uint8_t Wicked_DCMotor::bemf_channels = 0;
+/**
+ *  millis() time stamp of the most recent back-EMF measurement on any motor.
+ */
+uint32_t Wicked_DCMotor::bemf_last_window = 0;
+#endif
 
 /**
  * Constructor for WickedMotorShield, which has Wicked_DCMotor and
@@ -149,23 +278,41 @@ WickedMotorShield::WickedMotorShield(uint8_t use_alternate_pins){
 
   if( use_alternate_pins == USE_ALTERNATE_PINS){
     WickedMotorShield::SERIAL_DATA_PIN = 0;
+#if WMS_ENABLE_RCIN
     WickedMotorShield::RCIN1_PIN = 3;
     WickedMotorShield::RCIN2_PIN = 11;
+#endif
     WickedMotorShield::M1_PWM_PIN = 8;
     WickedMotorShield::M6_PWM_PIN = 4;
   }
+}
+/**
+ * Initialize the shield pins and load the shift registers.
+ *
+ * Only the first call does anything, so every motor object shares one
+ * initialization.  Calling begin() from setup() is optional; the first
+ * shift register load, setSpeed() or setPWMFrequency() performs it
+ * otherwise, so no output goes live before the brake state is latched.  All motor objects must have
+ * been constructed, so the pin set is known, before this runs.
+ */
+void WickedMotorShield::begin(void){
+  if(initialized){
+    return;
+  }
+  initialized = 1;
 
   // intialize pins
   pinMode(SERIAL_CLOCK_PIN, OUTPUT);
   pinMode(SERIAL_LATCH_PIN, OUTPUT);
   pinMode(SERIAL_DATA_PIN, OUTPUT);
 
+#if WMS_ENABLE_RCIN
   pinMode(RCIN1_PIN, INPUT);
   pinMode(RCIN2_PIN, INPUT);
-
-  for(uint8_t ii = 0; ii < 6; ii++){
-    old_dir[ii] = DIR_CW; // initial direction coming out of brake is clockwise
-  }
+#endif
+#if WMS_RCIN_CAPTURE
+  rcin_capture_start();
+#endif
 
   // load the initial values so the motors are set to a brake state initially
   load_shift_register();
@@ -173,16 +320,70 @@ WickedMotorShield::WickedMotorShield(uint8_t use_alternate_pins){
 /**
  *  Load the contents of second_shift_register and first_shift_register to the
  *  motor shield using SERIAL_LATCH_PIN, SERIAL_DATA_PIN, and SERIAL_CLOCK_PIN
- *  pins.
+ *  pins.  Calls begin() first if the shield has not been initialized.
  *
  *  Data is only moved from the memory values on the Arduino board to the
  *  motor shield.  No data is moved in the other direction.
  */
 void WickedMotorShield::load_shift_register(void){
+  if(!initialized){
+    begin(); // begin() loads the registers
+    return;
+  }
+
   digitalWrite(SERIAL_LATCH_PIN, LOW);
   shiftOut(SERIAL_DATA_PIN, SERIAL_CLOCK_PIN, LSBFIRST, second_shift_register);
   shiftOut(SERIAL_DATA_PIN, SERIAL_CLOCK_PIN, LSBFIRST, first_shift_register);
   digitalWrite(SERIAL_LATCH_PIN, HIGH);
+  trace(TRACE_SHIFT_REGISTER, first_shift_register, second_shift_register);
+}
+/**
+ *  Print the recorded trace, oldest event first.
+ *  @param out where to print, usually Serial
+ *
+ *  Each event is one line of hexadecimal fields: the time stamp, the event
+ *  type character and its two data bytes.  The dump starts with a
+ *  "# wms-trace 2" line giving the length of a time stamp unit in
+ *  nanoseconds, #WMS_TRACE_TICK_NS or 1000 once setPWMFrequency() has
+ *  reconfigured Timer0, and ends with "# end" so
+ *  extras/trace_decode.py can find it in a serial log.  Prints only the
+ *  header and footer when the recorder is compiled out.
+ */
+void WickedMotorShield::dumpTrace(Print & out){
+  out.print(F("# wms-trace 2 "));
+#if WMS_TRACE_DEPTH > 0
+  out.println(trace_micros ? 1000UL : (unsigned long) WMS_TRACE_TICK_NS);
+  uint8_t oldSREG = SREG;
+  cli();
+  uint8_t head = trace_head;
+  uint16_t count = trace_wrapped ? WMS_TRACE_DEPTH : head;
+  SREG = oldSREG;
+
+  uint8_t index = trace_wrapped ? head : 0;
+  for(uint16_t ii = 0; ii < count; ii++){
+    WickedTraceEvent * event = &trace_buffer[index];
+    out.print(event->time, HEX);
+    out.print(' ');
+    out.print((char) event->type);
+    out.print(' ');
+    out.print(event->data[0], HEX);
+    out.print(' ');
+    out.println(event->data[1], HEX);
+    index = (index + 1) & (WMS_TRACE_DEPTH - 1);
+  }
+#else
+  out.println((unsigned long) WMS_TRACE_TICK_NS);
+#endif
+  out.println(F("# end"));
+}
+/**
+ *  Discard all recorded trace events.
+ */
+void WickedMotorShield::clearTrace(void){
+#if WMS_TRACE_DEPTH > 0
+  trace_head = 0;
+  trace_wrapped = 0;
+#endif
 }
 /**
  *  Get the shift register information for a specific motor.
@@ -261,6 +462,7 @@ uint8_t WickedMotorShield::filter_mask(uint8_t shift_register_value, uint8_t mas
   return 1;
 }
 
+#if WMS_ENABLE_RCIN
 uint32_t WickedMotorShield::getRCIN(uint8_t rc_input_number, uint32_t timeout){
 
   uint8_t rc_input_pin = get_rc_input_pin(rc_input_number);
@@ -276,360 +478,632 @@ uint32_t WickedMotorShield::getRCIN(uint8_t rc_input_number, uint32_t timeout){
   return pulseIn(rc_input_pin, HIGH, timeout);
 }
 
-uint8_t WickedMotorShield::get_rc_input_pin(uint8_t rc_input_number){
-  if(rc_input_number == RCIN1){
-    return RCIN1_PIN;
-  }
-  else if(rc_input_number == RCIN2){
-    return RCIN2_PIN;
+/**
+ * Return the width of the last pulse measured on an RC input.
+ * @param rc_input_number #RCIN1 or #RCIN2
+ * @return pulse width in microseconds, or 0 if no pulse has been seen, the
+ *         input number is bad, or #WMS_RCIN_CAPTURE is disabled
+ *
+ * Unlike getRCIN() this does not wait for a pulse.
+ */
+uint16_t WickedMotorShield::getRCINWidth(uint8_t rc_input_number){
+#if WMS_RCIN_CAPTURE
+  if(rc_input_number != RCIN1 && rc_input_number != RCIN2){
+    return 0;
   }
 
-  //else
-  return 0xff;
+  uint8_t oldSREG = SREG;
+  cli();
+  uint16_t width = rc_width[rc_input_number - RCIN1];
+  SREG = oldSREG;
+  return width;
+#else
+  (void) rc_input_number;
+  return 0;
+#endif
 }
-
-// for pwm value use a value between 0 and 255
-void WickedMotorShield::setSpeedM(uint8_t motor_number, uint8_t pwm_val){
-  switch(motor_number){
-  case M1:
-    analogWrite(M1_PWM_PIN, pwm_val);
-    break;
-  case M2:
-    analogWrite(M2_PWM_PIN, pwm_val);
-    break;
-  case M3:
-    analogWrite(M3_PWM_PIN, pwm_val);
-    break;
-  case M4:
-    analogWrite(M4_PWM_PIN, pwm_val);
-    break;
-  case M5:
-    analogWrite(M5_PWM_PIN, pwm_val);
-    break;
-  case M6:
-    analogWrite(M6_PWM_PIN, pwm_val);
-    break;
+/**
+ * Check whether both RC inputs have completed a new pulse.
+ * @return 1 once per frame, when RCIN1 and RCIN2 have both been measured
+ *         since the previous 1 was returned, otherwise 0.  Always 0 when
+ *         #WMS_RCIN_CAPTURE is disabled.
+ */
+uint8_t WickedMotorShield::newRCINFrame(void){
+#if WMS_RCIN_CAPTURE
+  uint8_t oldSREG = SREG;
+  cli();
+  uint8_t fresh = rc_fresh;
+  if(fresh == 0x03){
+    rc_fresh = 0;
   }
+  SREG = oldSREG;
+  return fresh == 0x03;
+#else
+  return 0;
+#endif
 }
+#if WMS_RCIN_CAPTURE
 /**
- * Set the value for the direction in Mx_DIR_MASK bit and the element of the
- * old_dir directory.
- * @param motor_number number of motor for which direction is to be set
- * @param direction value to be set for direction (#DIR_CW or #DIR_CCW).  The
- *        value of DIR_CW is 1 while the value for DIR_CCW is set to 0.
- *
- * Change Jan, 2020 - No action to be taken if brake bit is set.
- *
- * This needs to be reviewed.  Either the brake status should be set to #BRAKE_OFF
- * when the direction is set or no action should be taken if the brake status
- * is not #BRAKE_OFF.  Should the brake status always be changed to BRAKE_OFF
- * if this method is called.
+ * Enable the pin change interrupts for RCIN1_PIN and RCIN2_PIN.
  */
-void WickedMotorShield::setDirectionData(uint8_t motor_number, uint8_t direction){
-  uint8_t shift_register_value = get_shift_register_value(motor_number);
-  uint8_t * p_shift_register_value = &shift_register_value;
-  uint8_t dir_operation   = OPERATION_NONE;
-  uint8_t brake_status = getMotorBrakeM(motor_number);
+void WickedMotorShield::rcin_capture_start(void){
+  uint8_t pins[2] = {RCIN1_PIN, RCIN2_PIN};
 
+  rc_rise_seen = 0;
 
-  if(motor_number >= 6){
-    return; // invalid motor_number, go no further
+  for(uint8_t ii = 0; ii < 2; ii++){
+    uint8_t pin = pins[ii];
+    rc_input_reg[ii] = portInputRegister(digitalPinToPort(pin));
+    rc_input_mask[ii] = digitalPinToBitMask(pin);
+    if(*rc_input_reg[ii] & rc_input_mask[ii]){
+      rc_level |= 1 << ii;
+    }
+    enable_pin_change(pin);
   }
-  if (brake_status > 0) { return; }
-  //TODO: is this the "correct" sense of DIR_CW / DIR_CCW
-  // this explicitly becomes the old direction value
-  if(direction == DIR_CW){
-    dir_operation = OPERATION_SET;
-    old_dir[motor_number] = 1;
+}
+#endif
+#if WMS_PCINT_ISR
+/**
+ * Enable the pin change interrupt for a digital pin, if it has one.
+ */
+void WickedMotorShield::enable_pin_change(uint8_t pin){
+  if(digitalPinToPCICR(pin) != 0){
+    *digitalPinToPCMSK(pin) |= _BV(digitalPinToPCMSKbit(pin));
+    *digitalPinToPCICR(pin) |= _BV(digitalPinToPCICRbit(pin));
   }
-  else if(direction == DIR_CCW){
-    dir_operation = OPERATION_CLEAR;
-    old_dir[motor_number] = 0;
+}
+/**
+ * Decode the encoders and time the RC input pulses.  Called from the pin
+ * change interrupt vectors.
+ *
+ * The encoders come first and cost a table lookup each, so edge rates in
+ * the tens of kHz can be followed.  micros() is only read when an RC input
+ * actually changed.
+ */
+void WickedMotorShield::pcint_service(void){
+#if WMS_ENABLE_ENCODER
+  for(uint8_t ii = 0; ii < WMS_ENCODER_COUNT; ii++){
+    WickedEncoder * enc = &encoders[ii];
+    if(enc->mask_a == 0){
+      continue; // free slot
+    }
+    uint8_t state = 0;
+    if(*enc->reg_a & enc->mask_a){
+      state |= 0x02;
+    }
+    if(*enc->reg_b & enc->mask_b){
+      state |= 0x01;
+    }
+    if(state != enc->state){
+      enc->position += quadrature_table[(enc->state << 2) | state];
+      enc->state = state;
+    }
   }
+#endif
+#if WMS_RCIN_CAPTURE
+  uint32_t now = 0;
+  uint8_t have_time = 0;
 
-  switch(motor_number){
-  case M1:
-    apply_mask(p_shift_register_value, M1_DIR_MASK, dir_operation);
-    break;
-  case M2:
-    apply_mask(p_shift_register_value, M2_DIR_MASK, dir_operation);
-    break;
-  case M3:
-    apply_mask(p_shift_register_value, M3_DIR_MASK, dir_operation);
-    break;
-  case M4:
-    apply_mask(p_shift_register_value, M4_DIR_MASK, dir_operation);
-    break;
-  case M5:
-    apply_mask(p_shift_register_value, M5_DIR_MASK, dir_operation);
-    break;
-  case M6:
-    apply_mask(p_shift_register_value, M6_DIR_MASK, dir_operation);
-    break;
+  for(uint8_t ii = 0; ii < 2; ii++){
+    uint8_t bit = 1 << ii;
+    uint8_t level = (*rc_input_reg[ii] & rc_input_mask[ii]) ? bit : 0;
+    if(level == (rc_level & bit)){
+      continue; // another pin on the same port changed
+    }
+    if(!have_time){
+      now = micros();
+      have_time = 1;
+    }
+    rc_level ^= bit;
+    if(level){
+      rc_rise_time[ii] = now;
+      rc_rise_seen |= bit;
+    }
+    else if(rc_rise_seen & bit){
+      rc_width[ii] = now - rc_rise_time[ii];
+      rc_fresh |= bit;
+    }
   }
+#endif
+}
 
-  set_shift_register_value(motor_number, shift_register_value);
+ISR(PCINT0_vect){
+  WickedMotorShield::pcint_service();
 }
+#if defined(PCINT1_vect)
+ISR(PCINT1_vect, ISR_ALIASOF(PCINT0_vect));
+#endif
+#if defined(PCINT2_vect)
+ISR(PCINT2_vect, ISR_ALIASOF(PCINT0_vect));
+#endif
+#endif
+#if WMS_ENABLE_ENCODER
 /**
- * Set the contents of the shift_registers to indicate the desired brake condition.
- * @param motor_number number of motor for which data is to be set
- * @param brake_type value is #BRAKE_OFF, BRAKE_HARD, or #BRAKE_SOFT.  Value  is
- *                   the new brake condition.
+ * Claim an encoder slot and start decoding two pins.
+ * @param pin_a digital pin of encoder channel A, 0xff for RCIN1_PIN
+ * @param pin_b digital pin of encoder channel B, 0xff for RCIN2_PIN
+ * @return the slot in #encoders, or 0xff if no slot is free or a pin has
+ *         no pin change interrupt
  *
- * Change Jan, 2020 :  The value of #WickedMotorShield#old_dir is only changed if brake status is
- *     changed from #BRAKE_OFF to (#BRAKE_HARD or #BRAKE_SOFT) or from
- *     (#BRAKE_HARD or #BRAKE_SOFT) to #BRAKE_OFF.
+ * The pins get their pull-ups enabled, which suits open collector encoder
+ * outputs.  With #WMS_RCIN_CAPTURE, an RC input whose pin is claimed here
+ * stops being measured.
  */
-void WickedMotorShield::setBrakeData(uint8_t motor_number, uint8_t brake_type){
-  uint8_t shift_register_value = get_shift_register_value(motor_number);
-  uint8_t * p_shift_register_value = &shift_register_value;
-  uint8_t brake_operation = OPERATION_NONE;
-  uint8_t dir_operation   = OPERATION_NONE;
-
-  if(motor_number >= 6){
-    return; // invalid motor_number, go no further
+uint8_t WickedMotorShield::attach_encoder(uint8_t pin_a, uint8_t pin_b){
+  begin();
+#if WMS_ENABLE_RCIN
+  if(pin_a == 0xff){
+    pin_a = RCIN1_PIN;
   }
-
-  // calculate the affect on the relevant shift register bits
-  //  TODO: Merging this if/else with next if/else would make code more readable
-  if(brake_type == BRAKE_OFF){
-    brake_operation = OPERATION_CLEAR;
-    dir_operation = OPERATION_NONE;
+  if(pin_b == 0xff){
+    pin_b = RCIN2_PIN;
+  }
+#endif
+  if(pin_a == 0xff || pin_b == 0xff || pin_a == pin_b){
+    return 0xff;
+  }
+  if(digitalPinToPCICR(pin_a) == 0 || digitalPinToPCICR(pin_b) == 0){
+    return 0xff;
   }
-  else if(brake_type == BRAKE_SOFT){
-    brake_operation = OPERATION_SET;
-    dir_operation = OPERATION_CLEAR;
 
+  uint8_t slot = 0;
+  while(slot < WMS_ENCODER_COUNT && encoders[slot].mask_a != 0){
+    slot++;
   }
-  else if(brake_type == BRAKE_HARD){
-    brake_operation = OPERATION_SET;
-    dir_operation = OPERATION_SET;
+  if(slot == WMS_ENCODER_COUNT){
+    return 0xff;
   }
-  uint8_t brake_status = getMotorBrakeM(motor_number);
 
-  // save / restore directionality
-  // we already know motor_number is a safe index into old_dir because we checked earlier
-  if(brake_type == BRAKE_OFF && brake_status > 0){
-    // when clearing the brake, restore the old_dir value
-    if(old_dir[motor_number] == 1){
-      dir_operation = OPERATION_SET;
-    }
-    else{
-      dir_operation = OPERATION_CLEAR;
+  pinMode(pin_a, INPUT_PULLUP);
+  pinMode(pin_b, INPUT_PULLUP);
+
+  uint8_t oldSREG = SREG;
+  cli();
+  WickedEncoder * enc = &encoders[slot];
+  enc->reg_a = portInputRegister(digitalPinToPort(pin_a));
+  enc->reg_b = portInputRegister(digitalPinToPort(pin_b));
+  enc->mask_b = digitalPinToBitMask(pin_b);
+  enc->state = ((*enc->reg_a & digitalPinToBitMask(pin_a)) ? 0x02 : 0)
+             | ((*enc->reg_b & enc->mask_b) ? 0x01 : 0);
+  enc->position = 0;
+  enc->mask_a = digitalPinToBitMask(pin_a); // last, this marks the slot in use
+#if WMS_RCIN_CAPTURE
+  uint8_t rc_pins[2] = {RCIN1_PIN, RCIN2_PIN};
+  for(uint8_t ii = 0; ii < 2; ii++){
+    if(rc_pins[ii] == pin_a || rc_pins[ii] == pin_b){
+      rc_input_mask[ii] = 0;
+      rc_level &= ~(1 << ii);
+      rc_rise_seen &= ~(1 << ii);
     }
   }
-  else if(brake_status == 0 && ((brake_type == BRAKE_SOFT) || (brake_type == BRAKE_HARD))){
-    // when applying the brake, save the old_dir value
-    old_dir[motor_number] = get_motor_directionM(motor_number);
+#endif
+  SREG = oldSREG;
+
+  enable_pin_change(pin_a);
+  enable_pin_change(pin_b);
+  return slot;
+}
+#endif
+
+uint8_t WickedMotorShield::get_rc_input_pin(uint8_t rc_input_number){
+  if(rc_input_number == RCIN1){
+    return RCIN1_PIN;
+  }
+  else if(rc_input_number == RCIN2){
+    return RCIN2_PIN;
+  }
+
+  //else
+  return 0xff;
+}
+#endif
+
+/**
+ * Return which shift register holds the bits for a specific motor.
+ * @param motor_number number of motor
+ * @return 0 for WickedMotorShield#first_shift_register (M1 to M4),
+ *         1 for WickedMotorShield#second_shift_register (M5 and M6)
+ */
+uint8_t WickedMotorShield::get_register_index(uint8_t motor_number){
+  if(motor_number == M5 || motor_number == M6){
+    return 1;
   }
 
+  return 0;
+}
+/**
+ * Return the direction bit mask for a specific motor.
+ * @param motor_number number of motor
+ * @return one of the Mx_DIR_MASK values, or 0 for a bad motor_number argument
+ */
+uint8_t WickedMotorShield::get_dir_mask(uint8_t motor_number){
   switch(motor_number){
   case M1:
-    apply_mask(p_shift_register_value, M1_BRAKE_MASK, brake_operation);
-    apply_mask(p_shift_register_value, M1_DIR_MASK, dir_operation);
-    break;
+    return M1_DIR_MASK;
   case M2:
-    apply_mask(p_shift_register_value, M2_BRAKE_MASK, brake_operation);
-    apply_mask(p_shift_register_value, M2_DIR_MASK, dir_operation);
-    break;
+    return M2_DIR_MASK;
   case M3:
-    apply_mask(p_shift_register_value, M3_BRAKE_MASK, brake_operation);
-    apply_mask(p_shift_register_value, M3_DIR_MASK, dir_operation);
-    break;
+    return M3_DIR_MASK;
   case M4:
-    apply_mask(p_shift_register_value, M4_BRAKE_MASK, brake_operation);
-    apply_mask(p_shift_register_value, M4_DIR_MASK, dir_operation);
-    break;
+    return M4_DIR_MASK;
   case M5:
-    apply_mask(p_shift_register_value, M5_BRAKE_MASK, brake_operation);
-    apply_mask(p_shift_register_value, M5_DIR_MASK, dir_operation);
-    break;
+    return M5_DIR_MASK;
   case M6:
-    apply_mask(p_shift_register_value, M6_BRAKE_MASK, brake_operation);
-    apply_mask(p_shift_register_value, M6_DIR_MASK, dir_operation);
-    break;
+    return M6_DIR_MASK;
   }
 
-  set_shift_register_value(motor_number, shift_register_value);
+  return 0;
 }
 /**
- * Return motor direction for a specific motor.
- * @param motor_number integer representing motor
- * @return shift register value for motor having done a bitwise
- *         and operation with the direction mask for the motor.  Value will
- *         zero if direction bit is set (counter clockwise).
- *         Otherwise it will be greater than zero
- *         if direction bit is not set (clockwise).
+ * Return the brake bit mask for a specific motor.
+ * @param motor_number number of motor
+ * @return one of the Mx_BRAKE_MASK values, or 0 for a bad motor_number argument
  */
-uint8_t WickedMotorShield::get_motor_directionM(uint8_t motor_number){
-  uint8_t shift_register_value = get_shift_register_value(motor_number);
-
+uint8_t WickedMotorShield::get_brake_mask(uint8_t motor_number){
   switch(motor_number){
   case M1:
-    return filter_mask(shift_register_value, M1_DIR_MASK);
+    return M1_BRAKE_MASK;
   case M2:
-    return filter_mask(shift_register_value, M2_DIR_MASK);
+    return M2_BRAKE_MASK;
   case M3:
-    return filter_mask(shift_register_value, M3_DIR_MASK);
+    return M3_BRAKE_MASK;
   case M4:
-    return filter_mask(shift_register_value, M4_DIR_MASK);
+    return M4_BRAKE_MASK;
   case M5:
-    return filter_mask(shift_register_value, M5_DIR_MASK);
+    return M5_BRAKE_MASK;
   case M6:
-    return filter_mask(shift_register_value, M6_DIR_MASK);
+    return M6_BRAKE_MASK;
   }
 
-  return 0xff; // indicate error - bad motor_number argument
-
+  return 0;
 }
 /**
- * Return motor brake status for a specific motor.
- * @param motor_number integer representing motor
- * @return shift register value for motor having done a bitwise
- *         and operation with the brake mask for the motor.  This
- *         will be zero if the brake bit is not set and greater
- *         than zero if the brake bit is set.
+ * Return the PWM pin for a specific motor.
+ * @param motor_number number of motor
+ * @return digital pin number, or 0xff for a bad motor_number argument
  */
-uint8_t WickedMotorShield::get_motor_brakeM(uint8_t motor_number){
-  uint8_t shift_register_value = get_shift_register_value(motor_number);
-
+uint8_t WickedMotorShield::get_pwm_pin(uint8_t motor_number){
   switch(motor_number){
   case M1:
-    return filter_mask(shift_register_value, M1_BRAKE_MASK);
+    return M1_PWM_PIN;
   case M2:
-    return filter_mask(shift_register_value, M2_BRAKE_MASK);
+    return M2_PWM_PIN;
   case M3:
-    return filter_mask(shift_register_value, M3_BRAKE_MASK);
+    return M3_PWM_PIN;
   case M4:
-    return filter_mask(shift_register_value, M4_BRAKE_MASK);
+    return M4_PWM_PIN;
   case M5:
-    return filter_mask(shift_register_value, M5_BRAKE_MASK);
+    return M5_PWM_PIN;
   case M6:
-    return filter_mask(shift_register_value, M6_BRAKE_MASK);
+    return M6_PWM_PIN;
   }
 
   return 0xff; // indicate error - bad motor_number argument
-
 }
-
+#if WMS_ENABLE_PWM_CONFIG
 /**
- *  Version number is hard-coded to a value of 1.
+ * Return the timer and compare channel driving a motor's PWM pin.
+ * @param motor_number number of motor
+ * @param channel set to 0 for compare channel A, 1 for channel B
+ * @return 0, 1 or 2 for Timer0, Timer1 or Timer2, or 0xff if the pin is not
+ *         on one of them or the board is not supported
+ *
+ * <table>
+ * <tr><td>Timer</td><td>Standard pins</td><td>Notes</td></tr>
+ * <tr><td>Timer0</td><td>M5 (pin 6, A), M3 (pin 5, B)</td><td>also runs millis()</td></tr>
+ * <tr><td>Timer1</td><td>M2 (pin 9, A), M4 (pin 10, B)</td><td>16 bit</td></tr>
+ * <tr><td>Timer2</td><td>M1 (pin 11, A), M6 (pin 3, B)</td><td>8 bit</td></tr>
+ * </table>
+ * With the alternate pins M1 and M6 are on pins 8 and 4, which have no PWM
+ * on these boards.
+ *
+ * Only the ATmega168/328 timers are known.  On any other board, including
+ * the ATmega2560 Mega where pins 8 and 4 are on Timer4 and Timer0, every
+ * motor returns 0xff.
  */
-uint8_t WickedMotorShield::version(void){
-  return 1;
-}
-
-
-
-Wicked_Stepper::Wicked_Stepper(uint16_t number_of_steps, uint8_t m1, uint8_t m2, uint8_t use_alternate_pins)
-  :WickedMotorShield(use_alternate_pins){
-
-  this->step_number = 0;                      // which step the motor is on
-  this->speed = 0;                            // the motor speed, in revolutions per minute
-  this->direction = 0;                        // motor direction
-  this->last_step_time = 0;                   // time stamp in ms of the last step taken
-  this->number_of_steps = number_of_steps;    // total number of steps for this motor
-
-  this->m1 = m1;
-  this->m2 = m2;
+uint8_t WickedMotorShield::get_pwm_timer(uint8_t motor_number, uint8_t * channel){
+#if PWM_TIMER_CONFIG
+  uint8_t pin = get_pwm_pin(motor_number);
+  if(pin == 0xff){
+    return 0xff;
+  }
 
-  setSpeedM(m1, 255);
-  setSpeedM(m2, 255);
-  setDirectionData(m1, DIR_CW);
-  setDirectionData(m2, DIR_CW);
-  setBrakeData(m1, BRAKE_OFF);
-  setBrakeData(m2, BRAKE_OFF);
-  load_shift_register();
-}
+  switch(digitalPinToTimer(pin)){
+  case TIMER0A:
+    *channel = 0;
+    return 0;
+  case TIMER0B:
+    *channel = 1;
+    return 0;
+  case TIMER1A:
+    *channel = 0;
+    return 1;
+  case TIMER1B:
+    *channel = 1;
+    return 1;
+  case TIMER2A:
+    *channel = 0;
+    return 2;
+  case TIMER2B:
+    *channel = 1;
+    return 2;
+  }
+#else
+  (void) motor_number;
+  (void) channel;
+#endif
 
-void Wicked_Stepper::setSpeed(uint32_t speed){
-  this->step_delay = 60L * 1000L / this->number_of_steps / speed;
+  return 0xff;
 }
+#endif
+#if WMS_ENABLE_CURRENT_SENSE
+/**
+ * Return the period of the PWM carrier driving a specific motor.
+ * @param motor_number number of motor
+ * @return period in microseconds, more than 65535 below about 16 Hz
+ *
+ * analogWrite() leaves the Timer0 pins at about 976 Hz (the timer also runs
+ * millis()) and every other timer at about 490 Hz, unless setPWMFrequency()
+ * has changed the timer.
+ */
+uint32_t WickedMotorShield::pwm_period_us(uint8_t motor_number){
+#if WMS_ENABLE_PWM_CONFIG
+  uint8_t channel;
+  uint8_t configured = get_pwm_timer(motor_number, &channel);
+  if(configured != 0xff && pwm_top[configured] != 0){
+    return (1000000L + pwm_frequency[configured] - 1) / pwm_frequency[configured];
+  }
+#endif
 
-void Wicked_Stepper::step(int16_t number_of_steps){
-  int steps_left = abs(number_of_steps);  // how many steps to take
+#if defined(TIMER0A)
+  uint8_t timer = digitalPinToTimer(get_pwm_pin(motor_number));
+  if(timer == TIMER0A || timer == TIMER0B){
+    return 1024;
+  }
+#endif
 
-  // determine direction based on whether steps_to_mode is + or -:
-  if (number_of_steps > 0) {this->direction = 1;}
-  if (number_of_steps < 0) {this->direction = 0;}
+  return 2040;
+}
+#endif
+#if WMS_ENABLE_PWM_CONFIG
+/**
+ * Set the PWM carrier frequency of the timer driving a motor.
+ * @param motor_number number of motor.  The other motor on the same timer
+ *        changes too; see get_pwm_timer() for the pairs.
+ * @param frequency_hz requested carrier frequency
+ * @param allow_millis_timer non-zero to allow changing Timer0.  This breaks
+ *        millis(), micros() and delay(), and with them the stepper timing,
+ *        idle timeouts, oversampled current sensing and the trace time
+ *        stamps.  The trace recorder is cleared and stamps later events
+ *        with micros().
+ * @return #PWM_CONFIG_OK, #PWM_CONFIG_INVALID, #PWM_CONFIG_MILLIS_CONFLICT or
+ *         #PWM_CONFIG_UNSUPPORTED
+ *
+ * Timer1 runs phase correct PWM with ICR1 as TOP, so its frequency can be
+ * set closely and the duty resolution is TOP + 1 steps: 401 steps at
+ * 20 kHz, 8001 steps at 1 kHz.  The 8-bit timers keep both outputs,
+ * so they stay at 256 steps and the nearest of the phase correct prescaler
+ * frequencies is used (31372, 3921, 980, 490, 245, 122 or 30 Hz for
+ * Timer2).  Duty values are then written straight to the compare
+ * registers by setSpeed() and setSpeedFine().  Both motors on the timer
+ * are left at a duty of 0.
+ *
+ * Supported on the ATmega168/328 boards only.  Elsewhere, including the
+ * Mega, and for M1 and M6 with the alternate pins, the result is
+ * #PWM_CONFIG_UNSUPPORTED and the motor keeps the analogWrite() frequency.
+ */
+uint8_t WickedMotorShield::setPWMFrequency(uint8_t motor_number, uint32_t frequency_hz, uint8_t allow_millis_timer){
+  uint8_t channel;
+  uint8_t timer = get_pwm_timer(motor_number, &channel);
 
+  if(motor_number >= 6 || frequency_hz == 0){
+    return PWM_CONFIG_INVALID;
+  }
+  if(timer == 0xff){
+    return PWM_CONFIG_UNSUPPORTED;
+  }
+  if(timer == 0 && !allow_millis_timer){
+    return PWM_CONFIG_MILLIS_CONFLICT;
+  }
+  begin(); // latch the brake image before the compare outputs take over the pins
 
-  // decrement the number of steps, moving one step each time:
-  while(steps_left > 0) {
-  // move only if the appropriate delay has passed:
-  if (millis() - this->last_step_time >= this->step_delay) {
-      // get the timeStamp of when you stepped:
-      this->last_step_time = millis();
-      // increment or decrement the step number,
-      // depending on direction:
-      if (this->direction == 1) {
-        this->step_number++;
-        if (this->step_number == this->number_of_steps) {
-          this->step_number = 0;
-        }
+#if PWM_TIMER_CONFIG
+  if(timer == 1){
+    static const uint16_t prescalers[5] = {1, 8, 64, 256, 1024};
+    uint8_t found = 0;
+    for(uint8_t ii = 0; ii < 5; ii++){
+      uint32_t top = F_CPU / (2UL * prescalers[ii] * frequency_hz);
+      if(top > 65535){
+        continue;
+      }
+      if(top < 4){
+        return PWM_CONFIG_INVALID; // too fast for a useful duty resolution
       }
-      else {
-        if (this->step_number == 0) {
-          this->step_number = this->number_of_steps;
-        }
-        this->step_number--;
+      uint8_t oldSREG = SREG;
+      cli();
+      TCCR1B = 0;
+      TCCR1A = _BV(COM1A1) | _BV(COM1B1) | _BV(WGM11);
+      ICR1 = top;
+      OCR1A = 0;
+      OCR1B = 0;
+      TCNT1 = 0;
+      TCCR1B = _BV(WGM13) | (ii + 1);
+      SREG = oldSREG;
+      pwm_top[1] = top;
+      pwm_frequency[1] = F_CPU / (2UL * prescalers[ii] * top);
+      found = 1;
+      break;
+    }
+    if(!found){
+      return PWM_CONFIG_INVALID; // too slow even with the largest prescaler
+    }
+  }
+  else{
+    // 8-bit timers: phase correct PWM, pick the closest prescaler
+    static const uint16_t prescalers0[5] = {1, 8, 64, 256, 1024};
+    static const uint16_t prescalers2[7] = {1, 8, 32, 64, 128, 256, 1024};
+    const uint16_t * prescalers = (timer == 0) ? prescalers0 : prescalers2;
+    uint8_t count = (timer == 0) ? 5 : 7;
+    uint8_t best = 0;
+    uint32_t best_error = 0xffffffff;
+    for(uint8_t ii = 0; ii < count; ii++){
+      uint32_t f = F_CPU / (510UL * prescalers[ii]);
+      uint32_t error = (f > frequency_hz) ? f - frequency_hz : frequency_hz - f;
+      if(error < best_error){
+        best = ii;
+        best_error = error;
       }
-      // decrement the steps left:
-      steps_left--;
-      // step the motor to step number 0, 1, 2, or 3:
-      stepMotor(this->step_number % 4);
+    }
+    uint8_t oldSREG = SREG;
+    cli();
+    if(timer == 0){
+      TCCR0A = _BV(COM0A1) | _BV(COM0B1) | _BV(WGM00);
+      TCCR0B = best + 1;
+      OCR0A = 0;
+      OCR0B = 0;
+#if WMS_TRACE_DEPTH > 0
+      // earlier stamps are Timer0 counts, later ones micros()
+      trace_micros = 1;
+      clearTrace();
+#endif
+    }
+    else{
+      TCCR2A = _BV(COM2A1) | _BV(COM2B1) | _BV(WGM20);
+      TCCR2B = best + 1;
+      OCR2A = 0;
+      OCR2B = 0;
+    }
+    SREG = oldSREG;
+    pwm_top[timer] = 255;
+    pwm_frequency[timer] = F_CPU / (510UL * prescalers[best]);
+  }
+
+  // the compare outputs now drive the pins, analogWrite() is no longer used
+  for(uint8_t motor = 0; motor < 6; motor++){
+    uint8_t other_channel;
+    if(get_pwm_timer(motor, &other_channel) == timer){
+      pinMode(get_pwm_pin(motor), OUTPUT);
     }
   }
+
+  return PWM_CONFIG_OK;
+#else
+  (void) allow_millis_timer;
+  return PWM_CONFIG_UNSUPPORTED;
+#endif
 }
+/**
+ * @param motor_number number of motor
+ * @return carrier frequency in Hz set by setPWMFrequency(), or 0 if the
+ *         motor's timer is still at the analogWrite() default
+ */
+uint32_t WickedMotorShield::getPWMFrequency(uint8_t motor_number){
+  uint8_t channel;
+  uint8_t timer = get_pwm_timer(motor_number, &channel);
+  if(timer == 0xff || pwm_top[timer] == 0){
+    return 0;
+  }
 
-//TODO: convert the code below into analogous shift register loads
-void Wicked_Stepper::stepMotor(int this_step){
-  switch (this_step) {
-  case 0:    // 1010
-    setDirectionData(m1, DIR_CW);
-    setDirectionData(m2, DIR_CCW);
-    break;
-  case 1:    // 0110
-    setDirectionData(m1, DIR_CCW);
-    setDirectionData(m2, DIR_CCW);
+  return pwm_frequency[timer];
+}
+/**
+ * @param motor_number number of motor
+ * @return number of distinct duty steps available to setSpeedFine() on
+ *         this motor: 256 unless setPWMFrequency() configured Timer1
+ */
+uint16_t WickedMotorShield::getPWMResolution(uint8_t motor_number){
+  uint8_t channel;
+  uint8_t timer = get_pwm_timer(motor_number, &channel);
+  if(timer == 0xff || pwm_top[timer] == 0){
+    return 256;
+  }
+
+  return pwm_top[timer] + 1;
+}
+/**
+ * Write a compare register of a timer configured by setPWMFrequency().
+ * @param timer 0, 1 or 2
+ * @param channel 0 for compare channel A, 1 for channel B
+ * @param value compare value, 0..TOP
+ */
+void WickedMotorShield::write_pwm_compare(uint8_t timer, uint8_t channel, uint16_t value){
+#if PWM_TIMER_CONFIG
+  switch(timer){
+  case 0:
+    if(channel == 0){ OCR0A = value; } else { OCR0B = value; }
     break;
-  case 2:    // 0101
-    setDirectionData(m1, DIR_CCW);
-    setDirectionData(m2, DIR_CW);
+  case 1:
+    // 16-bit register write, keep the ISR from using TEMP in between
+    {
+      uint8_t oldSREG = SREG;
+      cli();
+      if(channel == 0){ OCR1A = value; } else { OCR1B = value; }
+      SREG = oldSREG;
+    }
     break;
-  case 3:    // 1001
-    setDirectionData(m1, DIR_CW);
-    setDirectionData(m2, DIR_CW);
+  case 2:
+    if(channel == 0){ OCR2A = value; } else { OCR2B = value; }
     break;
   }
-
-  load_shift_register();
+#else
+  (void) timer;
+  (void) channel;
+  (void) value;
+#endif
 }
+/**
+ * Set a motor's duty with the full resolution of its timer.
+ * @param motor_number number of motor
+ * @param duty 0 (off) to 65535 (full on), scaled to the timer's TOP.
+ *        Without setPWMFrequency() only the top 8 bits are used.
+ */
+void WickedMotorShield::setSpeedFineM(uint8_t motor_number, uint16_t duty){
+  uint8_t channel;
+  uint8_t timer = get_pwm_timer(motor_number, &channel);
 
+  if(timer == 0xff || pwm_top[timer] == 0){
+    setSpeedM(motor_number, duty >> 8);
+    return;
+  }
 
-Wicked_DCMotor::Wicked_DCMotor(uint8_t motor_number, uint8_t use_alternate_pins)
-  :WickedMotorShield(use_alternate_pins){
-
-  this->motor_number = motor_number;
-}
-
-// for direction use one of the symbols: DIR_CW, DIR_CC
-void Wicked_DCMotor:: setDirection(uint8_t direction){
-  setDirectionData(motor_number, direction);
-  load_shift_register();
+  write_pwm_compare(timer, channel, ((uint32_t) duty * pwm_top[timer] + 32767) / 65535);
+  trace(TRACE_PWM, motor_number, duty >> 8);
 }
+#endif
 
-// for brake_type use one of the symbols: HARD, SOFT, OFF
-void Wicked_DCMotor::setBrake(uint8_t brake_type){
-  setBrakeData(motor_number, brake_type);
-  load_shift_register();
-}
+// for pwm value use a value between 0 and 255
+// calls begin() first so no PWM goes live before the brake image is latched
+void WickedMotorShield::setSpeedM(uint8_t motor_number, uint8_t pwm_val){
+  uint8_t pin = get_pwm_pin(motor_number);
+  if(pin == 0xff){
+    return; // invalid motor_number, go no further
+  }
+  begin();
 
-uint8_t Wicked_DCMotor::get_motor_direction(void){
-  return get_motor_directionM(motor_number);
+#if WMS_ENABLE_PWM_CONFIG
+  uint8_t channel;
+  uint8_t timer = get_pwm_timer(motor_number, &channel);
+  if(timer != 0xff && pwm_top[timer] != 0){
+    write_pwm_compare(timer, channel, ((uint32_t) pwm_val * pwm_top[timer] + 127) / 255);
+  }
+  else{
+    analogWrite(pin, pwm_val);
+  }
+#else
+  analogWrite(pin, pwm_val);
+#endif
+  trace(TRACE_PWM, motor_number, pwm_val);
 }
-
-uint16_t Wicked_DCMotor::currentSense(void){
+#if WMS_ENABLE_CURRENT_SENSE
+/**
+ * Read the current sense input for a specific motor.
+ * @param motor_number number of motor whose current is to be read
+ * @return raw 10-bit ADC reading, or 0xffff for a bad motor_number argument
+ *
+ * The current sense inputs are not in motor order; M2 and M3 are swapped
+ * on A2 and A1.
+ */
+uint16_t WickedMotorShield::currentSenseM(uint8_t motor_number){
   switch(motor_number){
   case M1:
     return analogRead(A0);
@@ -647,7 +1121,1265 @@ uint16_t Wicked_DCMotor::currentSense(void){
 
   return 0xffff; // indicate error - bad motor_number argument
 }
+/**
+ * Read the current sense input for a specific motor with the oversampling
+ * selected by Wicked_DCMotor#setOversampling().
+ * @param motor_number number of motor whose current is to be read
+ * @return sum of 4^n samples shifted right by n, a (10 + n)-bit value, or
+ *         0xffff for a bad motor_number argument
+ *
+ * The samples are spread evenly over a whole number of PWM carrier periods
+ * so the ripple at the carrier frequency averages out instead of aliasing
+ * into the result.  If the window would exceed the budget set by
+ * setSenseBudget(), fewer samples are taken and the result is scaled so it
+ * keeps the same units.
+ */
+uint16_t WickedMotorShield::currentSenseOversampledM(uint8_t motor_number){
+  if(motor_number >= 6){
+    return 0xffff; // invalid motor_number, go no further
+  }
 
-void Wicked_DCMotor::setSpeed(uint8_t pwm_val){
-  setSpeedM(motor_number, pwm_val);
+  uint8_t bits = oversample_bits[motor_number];
+  uint8_t effective_bits = bits;
+  uint32_t period = pwm_period_us(motor_number);
+  uint32_t window = 0;
+  uint16_t samples = 0;
+
+  // pick the most samples that fit the budget, rounded up to whole carrier periods
+  for(;;){
+    samples = 1 << (2 * effective_bits);
+    window = (uint32_t) samples * adc_conversion_us;
+    window = ((window + period - 1) / period) * period;
+    if(sense_budget_us == 0 || window <= sense_budget_us || effective_bits == 0){
+      break;
+    }
+    effective_bits--;
+  }
+
+  uint32_t spacing = window / samples;
+  uint32_t sum = 0;
+  uint32_t start = micros();
+  uint32_t next = 0;
+
+  for(uint16_t ii = 0; ii < samples; ii++){
+    while(micros() - start < next){
+      // wait for this sample's slot in the window
+    }
+    sum += currentSenseM(motor_number);
+    if(ii == 0){
+      uint32_t conversion = micros() - start;
+      if(conversion > 0 && conversion < 256){
+        adc_conversion_us = conversion;
+      }
+    }
+    next += spacing;
+  }
+
+  uint32_t elapsed = micros() - start;
+  if(elapsed > 0){
+    sample_rate[motor_number] = (uint32_t) samples * 1000000L / elapsed;
+  }
+
+  return (sum >> effective_bits) << (bits - effective_bits);
+}
+/**
+ * Limit the time taken by an oversampled current reading.
+ * @param max_us longest time in microseconds one reading may take, or 0 for
+ *        no limit
+ */
+void WickedMotorShield::setSenseBudget(uint16_t max_us){
+  sense_budget_us = max_us;
+}
+#endif
+/**
+ * Set the value for the direction in Mx_DIR_MASK bit and the element of the
+ * old_dir directory.
+ * @param motor_number number of motor for which direction is to be set
+ * @param direction value to be set for direction (#DIR_CW or #DIR_CCW).  The
+ *        value of DIR_CW is 1 while the value for DIR_CCW is set to 0.
+ *
+ * Change Jan, 2020 - No action to be taken if brake bit is set.
+ *
+ * This needs to be reviewed.  Either the brake status should be set to #BRAKE_OFF
+ * when the direction is set or no action should be taken if the brake status
+ * is not #BRAKE_OFF.  Should the brake status always be changed to BRAKE_OFF
+ * if this method is called.
+ */
+void WickedMotorShield::setDirectionData(uint8_t motor_number, uint8_t direction){
+  uint8_t shift_register_value = get_shift_register_value(motor_number);
+  uint8_t * p_shift_register_value = &shift_register_value;
+  uint8_t dir_operation   = OPERATION_NONE;
+  uint8_t brake_status = get_motor_brakeM(motor_number);
+
+
+  if(motor_number >= 6){
+    return; // invalid motor_number, go no further
+  }
+  if (brake_status > 0) { return; }
+  //TODO: is this the "correct" sense of DIR_CW / DIR_CCW
+  // this explicitly becomes the old direction value
+  if(direction == DIR_CW){
+    dir_operation = OPERATION_SET;
+    old_dir[motor_number] = 1;
+  }
+  else if(direction == DIR_CCW){
+    dir_operation = OPERATION_CLEAR;
+    old_dir[motor_number] = 0;
+  }
+
+  switch(motor_number){
+  case M1:
+    apply_mask(p_shift_register_value, M1_DIR_MASK, dir_operation);
+    break;
+  case M2:
+    apply_mask(p_shift_register_value, M2_DIR_MASK, dir_operation);
+    break;
+  case M3:
+    apply_mask(p_shift_register_value, M3_DIR_MASK, dir_operation);
+    break;
+  case M4:
+    apply_mask(p_shift_register_value, M4_DIR_MASK, dir_operation);
+    break;
+  case M5:
+    apply_mask(p_shift_register_value, M5_DIR_MASK, dir_operation);
+    break;
+  case M6:
+    apply_mask(p_shift_register_value, M6_DIR_MASK, dir_operation);
+    break;
+  }
+
+  set_shift_register_value(motor_number, shift_register_value);
+}
+/**
+ * Set the contents of the shift_registers to indicate the desired brake condition.
+ * @param motor_number number of motor for which data is to be set
+ * @param brake_type value is #BRAKE_OFF, BRAKE_HARD, or #BRAKE_SOFT.  Value  is
+ *                   the new brake condition.
+ *
+ * Change Jan, 2020 :  The value of #WickedMotorShield#old_dir is only changed if brake status is
+ *     changed from #BRAKE_OFF to (#BRAKE_HARD or #BRAKE_SOFT) or from
+ *     (#BRAKE_HARD or #BRAKE_SOFT) to #BRAKE_OFF.
+ */
+void WickedMotorShield::setBrakeData(uint8_t motor_number, uint8_t brake_type){
+  uint8_t shift_register_value = get_shift_register_value(motor_number);
+  uint8_t * p_shift_register_value = &shift_register_value;
+  uint8_t brake_operation = OPERATION_NONE;
+  uint8_t dir_operation   = OPERATION_NONE;
+
+  if(motor_number >= 6){
+    return; // invalid motor_number, go no further
+  }
+
+  // calculate the affect on the relevant shift register bits
+  //  TODO: Merging this if/else with next if/else would make code more readable
+  if(brake_type == BRAKE_OFF){
+    brake_operation = OPERATION_CLEAR;
+    dir_operation = OPERATION_NONE;
+  }
+  else if(brake_type == BRAKE_SOFT){
+    brake_operation = OPERATION_SET;
+    dir_operation = OPERATION_CLEAR;
+
+  }
+  else if(brake_type == BRAKE_HARD){
+    brake_operation = OPERATION_SET;
+    dir_operation = OPERATION_SET;
+  }
+  uint8_t brake_status = get_motor_brakeM(motor_number);
+
+  // save / restore directionality
+  // we already know motor_number is a safe index into old_dir because we checked earlier
+  if(brake_type == BRAKE_OFF && brake_status > 0){
+    // when clearing the brake, restore the old_dir value
+    if(old_dir[motor_number] == 1){
+      dir_operation = OPERATION_SET;
+    }
+    else{
+      dir_operation = OPERATION_CLEAR;
+    }
+  }
+  else if(brake_status == 0 && ((brake_type == BRAKE_SOFT) || (brake_type == BRAKE_HARD))){
+    // when applying the brake, save the old_dir value
+    old_dir[motor_number] = get_motor_directionM(motor_number);
+  }
+
+  switch(motor_number){
+  case M1:
+    apply_mask(p_shift_register_value, M1_BRAKE_MASK, brake_operation);
+    apply_mask(p_shift_register_value, M1_DIR_MASK, dir_operation);
+    break;
+  case M2:
+    apply_mask(p_shift_register_value, M2_BRAKE_MASK, brake_operation);
+    apply_mask(p_shift_register_value, M2_DIR_MASK, dir_operation);
+    break;
+  case M3:
+    apply_mask(p_shift_register_value, M3_BRAKE_MASK, brake_operation);
+    apply_mask(p_shift_register_value, M3_DIR_MASK, dir_operation);
+    break;
+  case M4:
+    apply_mask(p_shift_register_value, M4_BRAKE_MASK, brake_operation);
+    apply_mask(p_shift_register_value, M4_DIR_MASK, dir_operation);
+    break;
+  case M5:
+    apply_mask(p_shift_register_value, M5_BRAKE_MASK, brake_operation);
+    apply_mask(p_shift_register_value, M5_DIR_MASK, dir_operation);
+    break;
+  case M6:
+    apply_mask(p_shift_register_value, M6_BRAKE_MASK, brake_operation);
+    apply_mask(p_shift_register_value, M6_DIR_MASK, dir_operation);
+    break;
+  }
+
+  set_shift_register_value(motor_number, shift_register_value);
+}
+/**
+ * Return motor direction for a specific motor.
+ * @param motor_number integer representing motor
+ * @return shift register value for motor having done a bitwise
+ *         and operation with the direction mask for the motor.  Value will
+ *         zero if direction bit is set (counter clockwise).
+ *         Otherwise it will be greater than zero
+ *         if direction bit is not set (clockwise).
+ */
+uint8_t WickedMotorShield::get_motor_directionM(uint8_t motor_number){
+  uint8_t shift_register_value = get_shift_register_value(motor_number);
+
+  switch(motor_number){
+  case M1:
+    return filter_mask(shift_register_value, M1_DIR_MASK);
+  case M2:
+    return filter_mask(shift_register_value, M2_DIR_MASK);
+  case M3:
+    return filter_mask(shift_register_value, M3_DIR_MASK);
+  case M4:
+    return filter_mask(shift_register_value, M4_DIR_MASK);
+  case M5:
+    return filter_mask(shift_register_value, M5_DIR_MASK);
+  case M6:
+    return filter_mask(shift_register_value, M6_DIR_MASK);
+  }
+
+  return 0xff; // indicate error - bad motor_number argument
+
+}
+/**
+ * Return motor brake status for a specific motor.
+ * @param motor_number integer representing motor
+ * @return shift register value for motor having done a bitwise
+ *         and operation with the brake mask for the motor.  This
+ *         will be zero if the brake bit is not set and greater
+ *         than zero if the brake bit is set.
+ */
+uint8_t WickedMotorShield::get_motor_brakeM(uint8_t motor_number){
+  uint8_t shift_register_value = get_shift_register_value(motor_number);
+
+  switch(motor_number){
+  case M1:
+    return filter_mask(shift_register_value, M1_BRAKE_MASK);
+  case M2:
+    return filter_mask(shift_register_value, M2_BRAKE_MASK);
+  case M3:
+    return filter_mask(shift_register_value, M3_BRAKE_MASK);
+  case M4:
+    return filter_mask(shift_register_value, M4_BRAKE_MASK);
+  case M5:
+    return filter_mask(shift_register_value, M5_BRAKE_MASK);
+  case M6:
+    return filter_mask(shift_register_value, M6_BRAKE_MASK);
+  }
+
+  return 0xff; // indicate error - bad motor_number argument
+
+}
+
+/**
+ *  Version number is hard-coded to a value of 1.
+ */
+uint8_t WickedMotorShield::version(void){
+  return 1;
+}
+
+
+
+#if WMS_ENABLE_STEPPER
+Wicked_Stepper::Wicked_Stepper(uint16_t number_of_steps, uint8_t m1, uint8_t m2, uint8_t use_alternate_pins)
+  :WickedMotorShield(use_alternate_pins){
+
+  this->step_number = 0;                      // which step the motor is on
+  this->speed = 0;                            // the motor speed, in revolutions per minute
+  this->direction = 0;                        // motor direction
+  this->step_delay = 0;                       // no delay between steps until setSpeed is called
+  this->last_step_time = 0;                   // time stamp in ms of the last step taken
+  this->number_of_steps = number_of_steps;    // total number of steps for this motor
+
+  this->m1 = m1;
+  this->m2 = m2;
+
+#if WMS_ENABLE_CURRENT_SENSE
+  for(uint8_t ii = 0; ii < 8; ii++){
+    this->phase_baseline[ii] = 0;
+  }
+  this->stall_threshold = 100;
+  this->stall_steps = 2;
+  this->stall_count = 0;
+  this->last_current = 0;
+#endif
+
+  this->run_duty = 255;
+  this->accel_duty = 255;
+  this->accel_steps = 0;
+  this->hold_duty = 127;
+  this->hold_brake = BRAKE_OFF;
+  this->idle_timeout = 0;                     // never reduce holding current unless asked to
+  this->steps_since_idle = 0;
+  this->holding = 0;
+  this->applied_duty = 0;                     // coils are powered by the first step
+
+  // only the RAM image is prepared here; the first step latches it
+  this->phase = 0;
+  this->phase_count = 4;
+  build_phase_table(STEP_FULL);
+  first_shift_register = (first_shift_register & ~this->reg_mask[0]) | this->phase_table[0][0];
+  second_shift_register = (second_shift_register & ~this->reg_mask[1]) | this->phase_table[0][1];
+}
+
+void Wicked_Stepper::setSpeed(uint32_t speed){
+  this->step_delay = 60L * 1000L / this->number_of_steps / speed;
+}
+
+void Wicked_Stepper::step(int16_t number_of_steps){
+  int steps_left = abs(number_of_steps);  // how many steps to take
+
+  // determine direction based on whether steps_to_mode is + or -:
+  if (number_of_steps > 0) {this->direction = 1;}
+  if (number_of_steps < 0) {this->direction = 0;}
+
+
+  // decrement the number of steps, moving one step each time:
+  while(steps_left > 0) {
+    advance_step();
+    // decrement the steps left:
+    steps_left--;
+  }
+}
+/**
+ * Wait until the step delay has passed, then move one step in the
+ * current direction.
+ *
+ * Updates Wicked_Stepper#step_number and energizes the coils for the new phase.
+ */
+void Wicked_Stepper::advance_step(void){
+  // move only if the appropriate delay has passed:
+  while(millis() - this->last_step_time < this->step_delay){
+    // wait
+  }
+  // get the timeStamp of when you stepped:
+  this->last_step_time = millis();
+  power_for_step();
+  // increment or decrement the step number,
+  // depending on direction:
+  if (this->direction == 1) {
+    this->step_number++;
+    if (this->step_number == this->number_of_steps) {
+      this->step_number = 0;
+    }
+  }
+  else {
+    if (this->step_number == 0) {
+      this->step_number = this->number_of_steps;
+    }
+    this->step_number--;
+  }
+  // move to the next phase of the drive sequence in the same direction
+  if (this->direction == 1) {
+    this->phase++;
+    if (this->phase == this->phase_count) {
+      this->phase = 0;
+    }
+  }
+  else {
+    if (this->phase == 0) {
+      this->phase = this->phase_count;
+    }
+    this->phase--;
+  }
+  stepMotor(this->phase);
+}
+
+/**
+ * Energize the coils for one phase of the drive sequence.
+ * @param this_phase index into Wicked_Stepper#phase_table
+ *
+ * The table entry already holds the direction and brake bits of both coils,
+ * so the update is a masked merge into each shift register byte followed
+ * by a single latch.
+ */
+void Wicked_Stepper::stepMotor(uint8_t this_phase){
+  first_shift_register = (first_shift_register & ~this->reg_mask[0]) | this->phase_table[this_phase][0];
+  second_shift_register = (second_shift_register & ~this->reg_mask[1]) | this->phase_table[this_phase][1];
+  load_shift_register();
+}
+/**
+ * Coil states for each drive sequence, as {m1, m2} pairs.  1 drives the
+ * coil #DIR_CW, -1 drives it #DIR_CCW and 0 leaves it unpowered
+ * (#BRAKE_SOFT).
+ */
+static const int8_t full_step_sequence[4][2] = {{1,-1}, {-1,-1}, {-1,1}, {1,1}};
+static const int8_t half_step_sequence[8][2] = {{1,-1}, {0,-1}, {-1,-1}, {-1,0}, {-1,1}, {0,1}, {1,1}, {1,0}};
+static const int8_t wave_step_sequence[4][2] = {{0,-1}, {-1,0}, {0,1}, {1,0}};
+/**
+ * Fill Wicked_Stepper#phase_table with the shift register bits for every
+ * phase of a drive sequence.
+ * @param mode #STEP_FULL, #STEP_HALF or #STEP_WAVE
+ */
+void Wicked_Stepper::build_phase_table(uint8_t mode){
+  const int8_t (*sequence)[2] = full_step_sequence;
+  uint8_t coils[2] = {m1, m2};
+
+  if(mode == STEP_HALF){
+    sequence = half_step_sequence;
+  }
+  else if(mode == STEP_WAVE){
+    sequence = wave_step_sequence;
+  }
+
+  this->drive_mode = mode;
+  this->phase_count = (mode == STEP_HALF) ? 8 : 4;
+  this->reg_mask[0] = 0;
+  this->reg_mask[1] = 0;
+  for(uint8_t ii = 0; ii < 2; ii++){
+    uint8_t reg = get_register_index(coils[ii]);
+    this->reg_mask[reg] |= get_dir_mask(coils[ii]) | get_brake_mask(coils[ii]);
+  }
+
+  for(uint8_t p = 0; p < this->phase_count; p++){
+    this->phase_table[p][0] = 0;
+    this->phase_table[p][1] = 0;
+    for(uint8_t ii = 0; ii < 2; ii++){
+      uint8_t reg = get_register_index(coils[ii]);
+      if(sequence[p][ii] == 1){
+        this->phase_table[p][reg] |= get_dir_mask(coils[ii]);
+      }
+      else if(sequence[p][ii] == 0){
+        this->phase_table[p][reg] |= get_brake_mask(coils[ii]);
+      }
+    }
+  }
+}
+/**
+ * Select the drive sequence used by step() and home().
+ * @param mode #STEP_FULL (two coils on, the default), #STEP_HALF (alternating
+ *        one and two coils, twice the steps per revolution) or #STEP_WAVE
+ *        (one coil on, less torque and current)
+ *
+ * Step counts passed to step() are in units of the selected sequence, so
+ * with #STEP_HALF the number_of_steps given to the constructor should be
+ * the number of half steps per revolution.
+ *
+ * The new sequence continues from the rotor position: full step phase p
+ * is half step 2p and wave phase p is half step 2p + 1.  When the new
+ * sequence has no phase at that position, as between full and wave drive,
+ * the rotor moves half a step to the nearest one it has.  The new coil
+ * image is latched at once if the coils are powered; released coils stay
+ * released until the next step.
+ */
+void Wicked_Stepper::setDriveMode(uint8_t mode){
+  uint8_t half_phase = this->phase;
+
+  if(this->drive_mode == STEP_FULL){
+    half_phase = 2 * this->phase;
+  }
+  else if(this->drive_mode == STEP_WAVE){
+    half_phase = 2 * this->phase + 1;
+  }
+  build_phase_table(mode);
+  this->phase = (mode == STEP_HALF) ? half_phase : half_phase / 2;
+
+  if(this->holding && this->hold_brake != BRAKE_OFF){
+    return; // the hold brake owns the coil bits, the next step latches
+  }
+  first_shift_register = (first_shift_register & ~this->reg_mask[0]) | this->phase_table[this->phase][0];
+  second_shift_register = (second_shift_register & ~this->reg_mask[1]) | this->phase_table[this->phase][1];
+  if(this->applied_duty != 0){
+    load_shift_register();
+  }
+}
+
+/**
+ * Select the coil duty for the step about to be taken and leave any idle
+ * state.
+ *
+ * Only the PWM compare values are touched here.  A hold brake is cleared
+ * by the next phase image, which stepMotor() latches anyway, so coming out
+ * of idle costs no extra shift register load.
+ */
+void Wicked_Stepper::power_for_step(void){
+  uint8_t duty = this->run_duty;
+
+  this->holding = 0;
+
+  if(this->steps_since_idle < this->accel_steps){
+    duty = this->accel_duty;
+    this->steps_since_idle++;
+  }
+
+  if(duty != this->applied_duty){
+    setSpeedM(m1, duty);
+    setSpeedM(m2, duty);
+    this->applied_duty = duty;
+  }
+}
+/**
+ * Set the coil duty used while the motor is stepping.
+ * @param duty PWM value 0..255.  Takes effect on the next step.
+ */
+void Wicked_Stepper::setRunDuty(uint8_t duty){
+  this->run_duty = duty;
+}
+/**
+ * Set the coil duty used for the first steps after the motor has been idle.
+ * @param duty PWM value 0..255
+ * @param steps number of steps after leaving idle that use this duty
+ *        instead of the run duty.  0 disables the accelerate duty.
+ */
+void Wicked_Stepper::setAccelDuty(uint8_t duty, uint8_t steps){
+  this->accel_duty = duty;
+  this->accel_steps = steps;
+}
+/**
+ * Set the coil duty applied when the motor goes idle with a hold brake of
+ * #BRAKE_OFF.
+ * @param duty PWM value 0..255
+ */
+void Wicked_Stepper::setHoldDuty(uint8_t duty){
+  this->hold_duty = duty;
+}
+/**
+ * Set how long the motor may sit without stepping before update() reduces
+ * its holding current.
+ * @param timeout_ms idle time in milliseconds.  0 keeps the coils at the
+ *        run duty forever, which is the default.
+ * @param hold_brake #BRAKE_OFF holds position at the hold duty.
+ *        #BRAKE_SOFT de-energizes both coils and #BRAKE_HARD shorts them,
+ *        trading holding torque for no coil current at all.
+ */
+void Wicked_Stepper::setIdleTimeout(uint16_t timeout_ms, uint8_t hold_brake){
+  this->idle_timeout = timeout_ms;
+  this->hold_brake = hold_brake;
+}
+/**
+ * Apply the hold state once the motor has been idle for the idle timeout.
+ *
+ * Call this regularly from loop().  The next call to step() or home()
+ * returns the coils to the run or accelerate duty before the first phase
+ * change.
+ */
+void Wicked_Stepper::update(void){
+  if(this->holding || this->idle_timeout == 0){
+    return;
+  }
+  if(millis() - this->last_step_time < this->idle_timeout){
+    return;
+  }
+
+  if(this->hold_brake == BRAKE_OFF){
+    setSpeedM(m1, this->hold_duty);
+    setSpeedM(m2, this->hold_duty);
+    this->applied_duty = this->hold_duty;
+  }
+  else{
+    setBrakeData(m1, this->hold_brake);
+    setBrakeData(m2, this->hold_brake);
+    load_shift_register();
+  }
+  this->holding = 1;
+  this->steps_since_idle = 0;
+}
+#if WMS_ENABLE_CURRENT_SENSE
+/**
+ * Set the parameters used by home() to recognize a stall.
+ * @param threshold rise in combined coil current (ADC counts) above the
+ *        learned baseline for the current phase that marks a step as stalled
+ * @param consecutive_steps number of stalled steps in a row needed before
+ *        home() reports a stall.  Values of 0 are treated as 1.
+ *
+ * When the rotor stops turning the back-EMF disappears, so the coil current
+ * sampled just after a phase change rises above its free-running level.
+ */
+void Wicked_Stepper::setStallThreshold(uint16_t threshold, uint8_t consecutive_steps){
+  this->stall_threshold = threshold;
+  this->stall_steps = consecutive_steps > 0 ? consecutive_steps : 1;
+}
+/**
+ * Sample the current sense inputs of both coils.
+ * @return sum of the readings for coils m1 and m2
+ *
+ * Called right after a phase change, so every sample is taken at the same
+ * point of the coil current rise.
+ */
+uint16_t Wicked_Stepper::sample_phase_current(void){
+  this->last_current = currentSenseM(m1) + currentSenseM(m2);
+  return this->last_current;
+}
+/**
+ * Step toward a mechanical stop without a limit switch and use the stop
+ * as the home position.
+ * @param max_steps maximum number of steps to take.  The sign gives the
+ *        direction of travel, as for step().
+ * @param learn_steps number of steps at the start of the move used to
+ *        learn the free-running coil current for each phase.  The axis
+ *        must be able to move freely for these steps.
+ * @return number of steps taken when the stall was detected, or -1 if
+ *         no stall was seen within max_steps.
+ *
+ * On a stall the motor stays energized and Wicked_Stepper#step_number is
+ * reset to 0.  Use setSpeed() to select a slow homing speed and
+ * setStallThreshold() to tune detection for the motor.
+ */
+int32_t Wicked_Stepper::home(int16_t max_steps, uint16_t learn_steps){
+  int32_t steps_taken = 0;
+  int32_t steps_left = abs(max_steps);
+
+  if (max_steps > 0) {this->direction = 1;}
+  if (max_steps < 0) {this->direction = 0;}
+
+  if(learn_steps < this->phase_count){
+    learn_steps = this->phase_count; // every phase needs at least one sample
+  }
+
+  for(uint8_t ii = 0; ii < 8; ii++){
+    this->phase_baseline[ii] = 0;
+  }
+  this->stall_count = 0;
+
+  while(steps_left > 0){
+    advance_step();
+    steps_left--;
+    steps_taken++;
+
+    uint8_t phase = this->phase;
+    uint16_t sample = sample_phase_current();
+    uint16_t baseline = this->phase_baseline[phase];
+
+    if(steps_taken <= learn_steps){
+      // learning: running average of the free-running current for this phase
+      if(baseline == 0){
+        this->phase_baseline[phase] = sample;
+      }
+      else{
+        this->phase_baseline[phase] = baseline + ((int16_t) (sample - baseline) / 4);
+      }
+      continue;
+    }
+
+    if(sample > baseline + this->stall_threshold){
+      this->stall_count++;
+      if(this->stall_count >= this->stall_steps){
+        this->step_number = 0;
+        return steps_taken;
+      }
+    }
+    else{
+      // still turning; let the baseline follow slow changes such as warm-up
+      this->stall_count = 0;
+      this->phase_baseline[phase] = baseline + ((int16_t) (sample - baseline) / 16);
+    }
+  }
+
+  return -1;
+}
+/**
+ * @return combined coil current sampled after the most recent phase
+ *         change made by home().
+ */
+uint16_t Wicked_Stepper::getPhaseCurrent(void){
+  return this->last_current;
+}
+#endif
+#endif
+
+
+#if WMS_ENABLE_DCMOTOR
+Wicked_DCMotor::Wicked_DCMotor(uint8_t motor_number, uint8_t use_alternate_pins)
+  :WickedMotorShield(use_alternate_pins){
+
+  this->motor_number = motor_number;
+#if WMS_ENABLE_BEMF
+  this->bemf_pin = 0xff;
+  this->bemf_interval = 0;
+  this->bemf_settle_us = 0;
+  this->rpm_per_count = 0;
+  this->bemf_last_measure = 0;
+  this->speed_estimate = 0;
+  this->bemf_overhead_us = 0;
+#endif
+#if WMS_ENABLE_ENCODER
+  this->encoder = 0xff;
+  this->moving = 0;
+  this->max_speed = 0;
+  this->tolerance = 0;
+  this->position_gain = 0x20;
+  this->target = 0;
+  this->velocity_position = 0;
+  this->velocity_time = 0;
+  this->velocity = 0;
+#endif
+}
+
+// for direction use one of the symbols: DIR_CW, DIR_CC
+void Wicked_DCMotor:: setDirection(uint8_t direction){
+  setDirectionData(motor_number, direction);
+  load_shift_register();
+}
+
+// for brake_type use one of the symbols: HARD, SOFT, OFF
+void Wicked_DCMotor::setBrake(uint8_t brake_type){
+  setBrakeData(motor_number, brake_type);
+  load_shift_register();
+}
+
+uint8_t Wicked_DCMotor::get_motor_direction(void){
+  return get_motor_directionM(motor_number);
+}
+
+#if WMS_ENABLE_CURRENT_SENSE
+/**
+ * Read the motor current.
+ * @return raw 10-bit ADC reading, or a (10 + n)-bit value if
+ *         setOversampling() selected n extra bits
+ */
+uint16_t Wicked_DCMotor::currentSense(void){
+  if(motor_number < 6 && oversample_bits[motor_number] > 0){
+    return currentSenseOversampledM(motor_number);
+  }
+
+  return currentSenseM(motor_number);
+}
+#endif
+/**
+ * @return the motor number (#M1 to #M6) this object drives
+ */
+uint8_t Wicked_DCMotor::getMotorNumber(void){
+  return motor_number;
+}
+#if WMS_ENABLE_CURRENT_SENSE
+/**
+ * Select oversampling and decimation for currentSense().
+ * @param extra_bits number of extra bits of resolution, 0..6.  Each reading
+ *        takes 4^extra_bits samples, so 2 extra bits cost 16 conversions.
+ *        Larger values are limited to 6, a 16-bit result.
+ */
+void Wicked_DCMotor::setOversampling(uint8_t extra_bits){
+  if(motor_number >= 6){
+    return; // invalid motor_number, go no further
+  }
+  if(extra_bits > 6){
+    extra_bits = 6;
+  }
+  oversample_bits[motor_number] = extra_bits;
+}
+/**
+ * @return samples per second achieved by the most recent oversampled
+ *         currentSense() on this motor, or 0 if there has been none.
+ */
+uint16_t Wicked_DCMotor::getSampleRate(void){
+  if(motor_number >= 6){
+    return 0;
+  }
+
+  return sample_rate[motor_number];
+}
+#endif
+
+void Wicked_DCMotor::setSpeed(uint8_t pwm_val){
+  setSpeedM(motor_number, pwm_val);
+}
+#if WMS_ENABLE_PWM_CONFIG
+/**
+ *   Set the speed with the full duty resolution of the motor's timer.
+ *   @param duty 0..65535.  See WickedMotorShield::setPWMFrequency() and
+ *          WickedMotorShield::getPWMResolution().
+ */
+void Wicked_DCMotor::setSpeedFine(uint16_t duty){
+  setSpeedFineM(motor_number, duty);
+}
+#endif
+#if WMS_ENABLE_BEMF
+/**
+ * Enable speed estimation from the motor's back-EMF.
+ * @param analog_pin analog input wired, through a divider if needed, to the
+ *        motor terminal.  While the channel coasts the terminal voltage is
+ *        the back-EMF, which is proportional to speed.
+ * @param rpm_per_count conversion from ADC counts to RPM in 8.8 fixed point,
+ *        i.e. RPM per count times 256
+ * @param interval_ms time between measurements.  0 disables estimation.
+ * @param settle_us time the channel coasts before sampling, long enough for
+ *        the winding current to decay
+ *
+ * Measurements are taken by updateSpeedEstimate().  With several motors
+ * enabled, windows are spread so that no two channels coast at once and
+ * consecutive windows are at least interval_ms divided by the number of
+ * enabled motors apart.
+ */
+void Wicked_DCMotor::setBackEMF(uint8_t analog_pin, uint16_t rpm_per_count, uint16_t interval_ms, uint16_t settle_us){
+  if(this->bemf_interval == 0 && interval_ms != 0){
+    bemf_channels++;
+  }
+  else if(this->bemf_interval != 0 && interval_ms == 0){
+    bemf_channels--;
+  }
+
+  this->bemf_pin = analog_pin;
+  this->rpm_per_count = rpm_per_count;
+  this->bemf_interval = interval_ms;
+  this->bemf_settle_us = settle_us;
+}
+/**
+ * Take a back-EMF measurement if one is due.
+ * @return 1 if a new estimate was made, otherwise 0
+ *
+ * Call this regularly from loop().  The channel is put in #BRAKE_SOFT for
+ * the settle time, sampled, and returned to #BRAKE_OFF with its direction
+ * unchanged.  No measurement is made while a brake is applied, since the
+ * speed is then not being driven.
+ */
+uint8_t Wicked_DCMotor::updateSpeedEstimate(void){
+  if(this->bemf_interval == 0 || motor_number >= 6){
+    return 0;
+  }
+
+  uint32_t now = millis();
+  if(now - this->bemf_last_measure < this->bemf_interval){
+    return 0;
+  }
+  if(now - bemf_last_window < this->bemf_interval / bemf_channels){
+    return 0; // another channel measured recently, wait for our slot
+  }
+  if(get_motor_brakeM(motor_number) > 0){
+    return 0;
+  }
+
+  uint32_t start = micros();
+  setBrakeData(motor_number, BRAKE_SOFT);
+  load_shift_register();
+  delayMicroseconds(this->bemf_settle_us);
+  uint16_t counts = analogRead(this->bemf_pin);
+  setBrakeData(motor_number, BRAKE_OFF);
+  load_shift_register();
+  this->bemf_overhead_us = micros() - start;
+
+  this->speed_estimate = ((uint32_t) counts * this->rpm_per_count) >> 8;
+  this->bemf_last_measure = now;
+  bemf_last_window = now;
+  return 1;
+}
+/**
+ * @return most recent back-EMF speed estimate in RPM
+ */
+uint16_t Wicked_DCMotor::getSpeedEstimate(void){
+  return this->speed_estimate;
+}
+/**
+ * @return share of time the motor spends coasting for measurements, in
+ *         parts per thousand, based on the last measurement window
+ */
+uint16_t Wicked_DCMotor::getMeasurementOverhead(void){
+  if(this->bemf_interval == 0){
+    return 0;
+  }
+
+  return (uint32_t) this->bemf_overhead_us / this->bemf_interval;
+}
+#endif
+#if WMS_ENABLE_ENCODER
+/**
+ * Decode a quadrature encoder on this motor.
+ * @param pin_a digital pin of encoder channel A.  Defaults to RCIN1_PIN
+ *        when #WMS_ENABLE_RCIN is on,
+ *        repurposing the RC input.
+ * @param pin_b digital pin of encoder channel B.  Defaults to RCIN2_PIN.
+ * @return 1 on success, 0 if this motor already has an encoder, all
+ *         #WMS_ENCODER_COUNT slots are taken or a pin has no pin change
+ *         interrupt
+ *
+ * Every edge on either channel is counted, four counts per encoder line.
+ * The position counts up while A leads B; swap the pins if that is the
+ * #DIR_CCW direction of the motor, since moveTo() drives #DIR_CW to
+ * count up.
+ */
+uint8_t Wicked_DCMotor::attachEncoder(uint8_t pin_a, uint8_t pin_b){
+  if(this->encoder != 0xff){
+    return 0;
+  }
+
+  this->encoder = attach_encoder(pin_a, pin_b);
+  if(this->encoder == 0xff){
+    return 0;
+  }
+
+  this->velocity_position = 0;
+  this->velocity_time = micros();
+  this->velocity = 0;
+  return 1;
+}
+/**
+ * @return encoder position in counts, 0 if no encoder is attached
+ */
+int32_t Wicked_DCMotor::getPosition(void){
+  if(this->encoder == 0xff){
+    return 0;
+  }
+
+  uint8_t oldSREG = SREG;
+  cli();
+  int32_t position = encoders[this->encoder].position;
+  SREG = oldSREG;
+  return position;
+}
+/**
+ * Set the current encoder position, e.g. to 0 at a home switch.
+ * @param position new position in counts
+ */
+void Wicked_DCMotor::setPosition(int32_t position){
+  if(this->encoder == 0xff){
+    return;
+  }
+
+  uint8_t oldSREG = SREG;
+  cli();
+  encoders[this->encoder].position = position;
+  SREG = oldSREG;
+  this->velocity_position = position;
+  this->velocity_time = micros();
+}
+/**
+ * @return encoder velocity in counts per second
+ *
+ * The velocity is the position change over a window of at least 10 ms,
+ * restarted whenever this is called after the window has elapsed.  Call it,
+ * or updatePosition(), regularly for a current value.
+ */
+int32_t Wicked_DCMotor::getVelocity(void){
+  if(this->encoder == 0xff){
+    return 0;
+  }
+
+  uint32_t now = micros();
+  uint32_t elapsed = now - this->velocity_time;
+  if(elapsed < 10000){
+    return this->velocity;
+  }
+
+  int32_t position = getPosition();
+  int32_t delta = position - this->velocity_position;
+  int32_t ticks = elapsed >> 6; // 64 us units, 1000000 / 64 = 15625
+  if(delta > -0x20000L && delta < 0x20000L){
+    this->velocity = delta * 15625 / ticks;
+  }
+  else{
+    this->velocity = delta / ticks * 15625; // would overflow, lose precision instead
+  }
+  this->velocity_position = position;
+  this->velocity_time = now;
+  return this->velocity;
+}
+/**
+ * Set the proportional gain used by updatePosition().
+ * @param gain speed per count of position error in 4.4 fixed point, so 16
+ *        is one speed step per count.  The default is 32.
+ */
+void Wicked_DCMotor::setPositionGain(uint8_t gain){
+  this->position_gain = gain;
+}
+/**
+ * Start a move to an encoder position.
+ * @param target position in counts
+ * @param max_speed speed limit of the move, 0..255
+ * @param tolerance distance from target, in counts, at which the move ends
+ *
+ * The move is carried out by updatePosition(), which must be called
+ * regularly from loop().  This makes the first call.
+ */
+void Wicked_DCMotor::moveTo(int32_t target, uint8_t max_speed, uint8_t tolerance){
+  if(this->encoder == 0xff){
+    return;
+  }
+
+  this->target = target;
+  this->max_speed = max_speed;
+  this->tolerance = tolerance;
+  this->moving = 1;
+  updatePosition();
+}
+/**
+ * Drive the motor towards the moveTo() target.
+ * @return 1 on the call that ends the move, otherwise 0
+ *
+ * The speed is the position error times the gain from setPositionGain(),
+ * limited to the move's max_speed.  On arrival the channel is put in
+ * #BRAKE_HARD.  The direction and brake are only latched into the shift
+ * registers when they change.
+ */
+uint8_t Wicked_DCMotor::updatePosition(void){
+  getVelocity(); // keep the velocity window running
+  if(!this->moving || motor_number >= 6){
+    return 0;
+  }
+
+  int32_t error = this->target - getPosition();
+  uint32_t distance = (error < 0) ? -error : error;
+  uint8_t old_first = first_shift_register;
+  uint8_t old_second = second_shift_register;
+
+  if(distance <= this->tolerance){
+    setBrakeData(motor_number, BRAKE_HARD);
+    if(first_shift_register != old_first || second_shift_register != old_second){
+      load_shift_register();
+    }
+    this->moving = 0;
+    return 1;
+  }
+
+  uint32_t speed = (distance * this->position_gain) >> 4;
+  if(distance > 0x00ffffffUL || speed > this->max_speed){
+    speed = this->max_speed;
+  }
+
+  setBrakeData(motor_number, BRAKE_OFF);
+  setDirectionData(motor_number, (error > 0) ? DIR_CW : DIR_CCW);
+  if(first_shift_register != old_first || second_shift_register != old_second){
+    load_shift_register();
+  }
+  setSpeedM(motor_number, speed);
+  return 0;
+}
+/**
+ * @return non-zero while a moveTo() has not reached its target
+ */
+uint8_t Wicked_DCMotor::isMoving(void){
+  return this->moving;
+}
+#endif
+#endif
+
+#if WMS_ENABLE_DCMOTOR && WMS_ENABLE_RCIN
+/**
+ * Constructor for a mixer that turns the two RC inputs into commands for
+ * a set of Wicked_DCMotor channels.
+ * @param mode #MIX_TANK or #MIX_ARCADE
+ *
+ * Defaults: 1500 us center, 500 us to full stick, 20 us deadband, linear
+ * response, failsafe with #BRAKE_SOFT after 100 ms without a frame.
+ */
+Wicked_RCMixer::Wicked_RCMixer(uint8_t mode){
+  this->mode = mode;
+  this->sides = 0;
+  this->reversed = 0;
+  this->motor_count = 0;
+  this->expo = 0;
+  this->failsafe_ms = 100;
+  this->failsafe_brake = BRAKE_SOFT;
+  this->failsafe_active = 0;
+  this->last_frame = 0;
+  this->command[0] = 0;
+  this->command[1] = 0;
+  setCalibration(1500, 500, 20);
+}
+/**
+ * Add a motor to one side of the mix.
+ * @param motor motor to drive
+ * @param side #MIX_LEFT or #MIX_RIGHT
+ * @param reverse non-zero if positive commands should turn this motor
+ *        #DIR_CCW, for motors mounted mirror image
+ *
+ * Up to six motors can be attached.
+ */
+void Wicked_RCMixer::attach(Wicked_DCMotor & motor, uint8_t side, uint8_t reverse){
+  if(this->motor_count >= 6){
+    return;
+  }
+
+  uint8_t bit = 1 << this->motor_count;
+  this->motors[this->motor_count] = motor.getMotorNumber();
+  if(side == MIX_RIGHT){
+    this->sides |= bit;
+  }
+  if(reverse){
+    this->reversed |= bit;
+  }
+  this->motor_count++;
+}
+/**
+ * Set the stick calibration.
+ * @param center_us pulse width of a centered stick
+ * @param range_us change in pulse width from center to full stick
+ * @param deadband_us change in pulse width around center that is treated
+ *        as centered.  Must be smaller than range_us.
+ */
+void Wicked_RCMixer::setCalibration(uint16_t center_us, uint16_t range_us, uint16_t deadband_us){
+  if(deadband_us >= range_us){
+    deadband_us = range_us - 1;
+  }
+
+  this->center_us = center_us;
+  this->range_us = range_us;
+  this->deadband_us = deadband_us;
+  this->scale = (255L * 256L) / (range_us - deadband_us);
+}
+/**
+ * Set the stick response curve.
+ * @param expo 0 for a linear response up to 255 for a cubic one, which
+ *        gives finer control near center
+ */
+void Wicked_RCMixer::setExpo(uint8_t expo){
+  this->expo = expo;
+}
+/**
+ * Set what happens when the RC signal is lost.
+ * @param timeout_ms time without a valid frame before the failsafe is
+ *        applied.  0 disables the failsafe.
+ * @param brake_type brake applied to every attached motor in failsafe
+ */
+void Wicked_RCMixer::setFailsafe(uint16_t timeout_ms, uint8_t brake_type){
+  this->failsafe_ms = timeout_ms;
+  this->failsafe_brake = brake_type;
+}
+/**
+ * Convert a pulse width to a stick position.
+ * @param width pulse width in microseconds
+ * @return -255..255 after deadband and expo
+ */
+int16_t Wicked_RCMixer::shape(uint16_t width){
+  int16_t x = (int16_t) width - (int16_t) this->center_us;
+
+  if(x > (int16_t) this->range_us){
+    x = this->range_us;
+  }
+  else if(x < -(int16_t) this->range_us){
+    x = -(int16_t) this->range_us;
+  }
+
+  if(x > (int16_t) this->deadband_us){
+    x -= this->deadband_us;
+  }
+  else if(x < -(int16_t) this->deadband_us){
+    x += this->deadband_us;
+  }
+  else{
+    return 0;
+  }
+
+  // round the magnitude so both sides of center map alike
+  int32_t y = ((int32_t) (x < 0 ? -x : x) * this->scale + 128) >> 8;
+  if(y > 255){
+    y = 255;
+  }
+  if(x < 0){
+    y = -y;
+  }
+
+  if(this->expo){
+    // blend between y and y^3 / 255^2
+    int32_t cube = y * y / 255 * y / 255;
+    y += ((int32_t) this->expo * (cube - y)) / 255;
+  }
+
+  return y;
+}
+/**
+ * Drive every attached motor from the left and right commands with a
+ * single shift register load.
+ * @param left command for #MIX_LEFT motors, -255..255
+ * @param right command for #MIX_RIGHT motors, -255..255
+ */
+void Wicked_RCMixer::apply(int16_t left, int16_t right){
+  uint8_t duty[6];
+
+  for(uint8_t ii = 0; ii < this->motor_count; ii++){
+    uint8_t bit = 1 << ii;
+    int16_t value = (this->sides & bit) ? right : left;
+    if(this->reversed & bit){
+      value = -value;
+    }
+    setBrakeData(this->motors[ii], BRAKE_OFF);
+    setDirectionData(this->motors[ii], value < 0 ? DIR_CCW : DIR_CW);
+    duty[ii] = value < 0 ? -value : value;
+  }
+  load_shift_register();
+  for(uint8_t ii = 0; ii < this->motor_count; ii++){
+    setSpeedM(this->motors[ii], duty[ii]);
+  }
+
+  this->command[0] = left;
+  this->command[1] = right;
+}
+/**
+ * Stop every attached motor with the failsafe brake.
+ */
+void Wicked_RCMixer::apply_failsafe(void){
+  for(uint8_t ii = 0; ii < this->motor_count; ii++){
+    setSpeedM(this->motors[ii], 0);
+    setBrakeData(this->motors[ii], this->failsafe_brake);
+  }
+  load_shift_register();
+
+  this->command[0] = 0;
+  this->command[1] = 0;
+  this->failsafe_active = 1;
+}
+/**
+ * Read the RC inputs and drive the attached motors.
+ * @return 1 if a new frame was applied, otherwise 0
+ *
+ * Call this from loop() as often as possible.  With #WMS_RCIN_CAPTURE
+ * enabled it never blocks and only does work when both RC inputs have a
+ * new pulse.  Otherwise it measures both inputs with getRCIN(), which
+ * waits for up to one frame per input.  Pulses outside 500..2500 us are
+ * ignored and count toward the failsafe timeout.
+ */
+uint8_t Wicked_RCMixer::update(void){
+  uint16_t width1 = 0;
+  uint16_t width2 = 0;
+
+#if WMS_RCIN_CAPTURE
+  if(newRCINFrame()){
+    width1 = getRCINWidth(RCIN1);
+    width2 = getRCINWidth(RCIN2);
+  }
+#else
+  width1 = getRCIN(RCIN1, 25000);
+  width2 = getRCIN(RCIN2, 25000);
+#endif
+
+  if(width1 < 500 || width1 > 2500 || width2 < 500 || width2 > 2500){
+    if(this->failsafe_ms && !this->failsafe_active && millis() - this->last_frame >= this->failsafe_ms){
+      apply_failsafe();
+    }
+    return 0;
+  }
+
+  int16_t a = shape(width1);
+  int16_t b = shape(width2);
+  int16_t left = a;
+  int16_t right = b;
+
+  if(this->mode == MIX_ARCADE){
+    left = a + b;
+    right = a - b;
+    left = left > 255 ? 255 : (left < -255 ? -255 : left);
+    right = right > 255 ? 255 : (right < -255 ? -255 : right);
+  }
+
+  apply(left, right);
+  this->last_frame = millis();
+  this->failsafe_active = 0;
+  return 1;
+}
+/**
+ * @param side #MIX_LEFT or #MIX_RIGHT
+ * @return last command applied to that side, -255..255
+ */
+int16_t Wicked_RCMixer::getCommand(uint8_t side){
+  return this->command[side == MIX_RIGHT ? 1 : 0];
 }
+#endif
@@ -31,6 +31,39 @@ WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.  */
 #endif
 
 #include <stdint.h>
+#include "WickedMotorShieldConfig.h"
+
+#if (WMS_TRACE_DEPTH & (WMS_TRACE_DEPTH - 1)) != 0 || WMS_TRACE_DEPTH > 256
+#error "WMS_TRACE_DEPTH must be 0 or a power of two no larger than 256"
+#endif
+#if WMS_TRACE_DEPTH > 0 && defined(TCNT0) && defined(TIFR0)
+extern volatile unsigned long timer0_overflow_count; // kept by the core's Timer0 interrupt
+/**
+ * Length of a trace time stamp unit in nanoseconds: one count of Timer0,
+ * which the core runs at F_CPU / 64.  Once setPWMFrequency() has taken
+ * over Timer0 the stamps are micros() instead, see dumpTrace().
+ */
+#define WMS_TRACE_TICK_NS (64000000000ULL / F_CPU)
+#else
+#define WMS_TRACE_TICK_NS (1000)
+#endif
+#if WMS_RCIN_CAPTURE && !WMS_ENABLE_RCIN
+#error "WMS_RCIN_CAPTURE needs WMS_ENABLE_RCIN"
+#endif
+#if WMS_RCIN_CAPTURE && !defined(PCICR)
+#error "WMS_RCIN_CAPTURE needs an AVR with pin change interrupts"
+#endif
+#if WMS_ENABLE_ENCODER && !WMS_ENABLE_DCMOTOR
+#error "WMS_ENABLE_ENCODER needs WMS_ENABLE_DCMOTOR"
+#endif
+#if WMS_ENABLE_ENCODER && !defined(PCICR)
+#error "WMS_ENABLE_ENCODER needs an AVR with pin change interrupts"
+#endif
+#if WMS_ENABLE_ENCODER && (WMS_ENCODER_COUNT < 1 || WMS_ENCODER_COUNT > 6)
+#error "WMS_ENCODER_COUNT must be 1 to 6"
+#endif
+// the library defines the pin change interrupt vectors
+#define WMS_PCINT_ISR (WMS_RCIN_CAPTURE || WMS_ENABLE_ENCODER)
 /**  Integer value defining counterclockwise rotation.  (Value = 0) */
 #define DIR_CCW	(0)
 /** Integer value defining clockwise rotation. (Value = 1) */
@@ -185,6 +218,23 @@ WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.  */
 #define RCIN1      (1) 
 #define RCIN2      (2)
 
+/**
+ * Wicked_RCMixer mode: RCIN1 drives the left side, RCIN2 the right side.
+ */
+#define MIX_TANK   (0)
+/**
+ * Wicked_RCMixer mode: RCIN1 is throttle, RCIN2 is steering.
+ */
+#define MIX_ARCADE (1)
+/**
+ * Wicked_RCMixer side for motors on the left.
+ */
+#define MIX_LEFT   (0)
+/**
+ * Wicked_RCMixer side for motors on the right.
+ */
+#define MIX_RIGHT  (1)
+
 #define SERIAL_CLOCK_PIN (2)
 #define SERIAL_LATCH_PIN (7)
 
@@ -194,15 +244,146 @@ WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.  */
 
 #define USE_ALTERNATE_PINS (1)
 
+/**
+ * WickedMotorShield::setPWMFrequency() result: timer configured.
+ */
+#define PWM_CONFIG_OK              (0)
+/**
+ * WickedMotorShield::setPWMFrequency() result: bad motor number or a
+ * frequency the timer cannot produce.
+ */
+#define PWM_CONFIG_INVALID         (1)
+/**
+ * WickedMotorShield::setPWMFrequency() result: the motor is on Timer0,
+ * which also runs millis(), and changing it was not allowed.
+ */
+#define PWM_CONFIG_MILLIS_CONFLICT (2)
+/**
+ * WickedMotorShield::setPWMFrequency() result: the motor's pin is not on a
+ * timer this board supports.  Only ATmega168/328 boards are supported, and
+ * there M1 and M6 have no PWM timer with the alternate pins.
+ */
+#define PWM_CONFIG_UNSUPPORTED     (3)
+
+/**
+ * Trace event type for a shift register load.  The data bytes are
+ * WickedMotorShield#first_shift_register and
+ * WickedMotorShield#second_shift_register.
+ */
+#define TRACE_SHIFT_REGISTER ('S')
+/**
+ * Trace event type for a PWM duty change.  The data bytes are the motor
+ * number and the duty.
+ */
+#define TRACE_PWM            ('P')
+
+/**
+ * One entry of the trace recorder.
+ */
+struct WickedTraceEvent{
+  uint32_t time;    // WickedMotorShield::trace_ticks() when recorded
+  uint8_t type;     // TRACE_SHIFT_REGISTER or TRACE_PWM
+  uint8_t data[2];  // event data, see the event type
+};
+
+/**
+ * State of one quadrature encoder, updated by the pin change interrupt.
+ */
+struct WickedEncoder{
+  volatile uint8_t * reg_a;   // input register of channel A
+  volatile uint8_t * reg_b;   // input register of channel B
+  uint8_t mask_a;             // bit mask of channel A, 0 if the slot is free
+  uint8_t mask_b;             // bit mask of channel B
+  uint8_t state;              // (A << 1) | B at the last interrupt
+  volatile int32_t position;  // counts, four per encoder line
+};
+
+/**
+ * Stepper drive sequence with both coils energized on every step.
+ */
+#define STEP_FULL  (0)
+/**
+ * Stepper drive sequence alternating one and two energized coils.
+ */
+#define STEP_HALF  (1)
+/**
+ * Stepper drive sequence with one coil energized on every step.
+ */
+#define STEP_WAVE  (2)
+
 class WickedMotorShield{
  private:
-   static uint8_t first_shift_register;
-   static uint8_t second_shift_register;
    static uint8_t SERIAL_DATA_PIN;
+#if WMS_ENABLE_RCIN
    static uint8_t RCIN1_PIN;
    static uint8_t RCIN2_PIN;
+#endif
+   static uint8_t initialized;
+#if WMS_TRACE_DEPTH > 0
+   static WickedTraceEvent trace_buffer[WMS_TRACE_DEPTH];
+   static uint8_t trace_head;
+   static uint8_t trace_wrapped;
+   static uint8_t trace_micros;
+   /*  Time stamp for a trace event, in units of #WMS_TRACE_TICK_NS.
+    *
+    *  Reads the Timer0 overflow count and TCNT0 the way micros() does, but
+    *  without the call and the scaling, so recording stays cheap enough
+    *  for the interrupt handlers.  Those counts only mean time while Timer0
+    *  runs fast PWM at clk/64, so after setPWMFrequency() has changed it
+    *  this is micros().
+    */
+   static inline uint32_t trace_ticks(void){
+#if defined(TCNT0) && defined(TIFR0)
+     if(trace_micros){
+       return micros();
+     }
+     uint8_t oldSREG = SREG;
+     cli();
+     uint32_t overflows = timer0_overflow_count;
+     uint8_t count = TCNT0;
+     if((TIFR0 & _BV(TOV0)) && count < 255){
+       overflows++; // overflow not yet serviced
+     }
+     SREG = oldSREG;
+     return (overflows << 8) | count;
+#else
+     return micros();
+#endif
+   }
+   /*  Record an event in the trace ring, see dumpTrace(). */
+   static inline void trace(uint8_t type, uint8_t data0, uint8_t data1){
+     WickedTraceEvent * event = &trace_buffer[trace_head];
+     event->time = trace_ticks();
+     event->type = type;
+     event->data[0] = data0;
+     event->data[1] = data1;
+     trace_head = (trace_head + 1) & (WMS_TRACE_DEPTH - 1);
+     if(trace_head == 0){
+       trace_wrapped = 1;
+     }
+   }
+#else
+   static inline void trace(uint8_t, uint8_t, uint8_t){}
+#endif
+#if WMS_RCIN_CAPTURE
+   static volatile uint8_t * rc_input_reg[2];
+   static uint8_t rc_input_mask[2];
+   static uint8_t rc_level;
+   static uint8_t rc_rise_seen;
+   static uint32_t rc_rise_time[2];
+   static volatile uint16_t rc_width[2];
+   static volatile uint8_t rc_fresh;
+   static void rcin_capture_start(void);
+#endif
+#if WMS_PCINT_ISR
+   static void enable_pin_change(uint8_t pin);
+#endif
+#if WMS_ENABLE_RCIN
    static uint8_t get_rc_input_pin(uint8_t rc_input_number);
+#endif
  protected:
+   static uint8_t first_shift_register;
+   static uint8_t second_shift_register;
     /* Digital pin to be used for setting PWM (pulse width modulation) duty cycle for motor M1.
      *
      * Value is different for standard and alternate pins.
@@ -214,26 +395,80 @@ class WickedMotorShield{
      */
    static uint8_t M6_PWM_PIN;
    static uint8_t old_dir[6];
+#if WMS_ENABLE_CURRENT_SENSE
+   static uint8_t oversample_bits[6];
+   static uint16_t sample_rate[6];
+   static uint16_t sense_budget_us;
+   static uint8_t adc_conversion_us;
+   static uint32_t pwm_period_us(uint8_t motor_number);
+#endif
+   static uint8_t get_pwm_pin(uint8_t motor_number);
+   static uint8_t get_register_index(uint8_t motor_number);
+   static uint8_t get_dir_mask(uint8_t motor_number);
+   static uint8_t get_brake_mask(uint8_t motor_number);
+#if WMS_ENABLE_PWM_CONFIG
+   static uint16_t pwm_top[3];
+   static uint32_t pwm_frequency[3];
+   static uint8_t get_pwm_timer(uint8_t motor_number, uint8_t * channel);
+   static void write_pwm_compare(uint8_t timer, uint8_t channel, uint16_t value);
+#endif
+#if WMS_ENABLE_ENCODER
+   static WickedEncoder encoders[WMS_ENCODER_COUNT];
+   static const int8_t quadrature_table[16];
+   static uint8_t attach_encoder(uint8_t pin_a, uint8_t pin_b);
+#endif
    uint8_t get_shift_register_value(uint8_t motor_number);   
    void apply_mask(uint8_t * shift_register_value, uint8_t mask, uint8_t operation);
    uint8_t filter_mask(uint8_t shift_register_value, uint8_t mask);
    void set_shift_register_value(uint8_t motor_number, uint8_t value);       
-   void load_shift_register(void);    
+   static void load_shift_register(void);    
    uint8_t get_motor_directionM(uint8_t motor_number);     
    uint8_t get_motor_brakeM(uint8_t motor_number);     
+#if WMS_ENABLE_CURRENT_SENSE
+   uint16_t currentSenseM(uint8_t motor_number);
+   uint16_t currentSenseOversampledM(uint8_t motor_number);
+#endif
     
    void setSpeedM(uint8_t motor_number, uint8_t pwm_val);               // 0..255
+#if WMS_ENABLE_PWM_CONFIG
+   void setSpeedFineM(uint8_t motor_number, uint16_t duty);             // 0..65535
+#endif
    void setDirectionData(uint8_t motor_number, uint8_t direction);      // DIR_CCW, DIR_CW
    void setBrakeData(uint8_t motor_number, uint8_t brake_type);         // BRAKE_HARD, BRAKE_SOFT, BRAKE_OFF       
  public:
    WickedMotorShield(uint8_t use_alternate_pins = 0); // defaults for arduino uno                        
+   static void begin(void);
+#if WMS_ENABLE_RCIN
    static uint32_t getRCIN(uint8_t rc_input_number, uint32_t timeout = 0); // returns the result for pulseIn for the requested channel
+   static uint16_t getRCINWidth(uint8_t rc_input_number);
+   static uint8_t newRCINFrame(void);
+#endif
+#if WMS_PCINT_ISR
+   static void pcint_service(void);
+#endif
    static uint8_t version(void);
+#if WMS_ENABLE_CURRENT_SENSE
+   static void setSenseBudget(uint16_t max_us);
+#endif
+#if WMS_ENABLE_PWM_CONFIG
+   static uint8_t setPWMFrequency(uint8_t motor_number, uint32_t frequency_hz, uint8_t allow_millis_timer = 0);
+   static uint32_t getPWMFrequency(uint8_t motor_number);
+   static uint16_t getPWMResolution(uint8_t motor_number);
+#endif
+   static void dumpTrace(Print & out);
+   static void clearTrace(void);
 };
 
+#if WMS_ENABLE_STEPPER
 class Wicked_Stepper : public WickedMotorShield{
  private:
-    void stepMotor(int this_step);
+    void stepMotor(uint8_t this_phase);
+    void build_phase_table(uint8_t mode);
+    void advance_step(void);
+#if WMS_ENABLE_CURRENT_SENSE
+    uint16_t sample_phase_current(void);
+#endif
+    void power_for_step(void);
 
     uint8_t direction;             // Direction of rotation
     uint16_t speed;                // Speed in RPMs
@@ -243,18 +478,73 @@ class Wicked_Stepper : public WickedMotorShield{
     uint32_t last_step_time;       // time stamp in ms of when the last step was taken
     uint8_t m1;                    // the M-number of the first coil
     uint8_t m2;                    // the M-number of the second coil
+    uint8_t phase_table[8][2];     // shift register bits for each phase, [phase][register]
+    uint8_t reg_mask[2];           // shift register bits owned by m1 and m2
+    uint8_t phase_count;           // 4 for STEP_FULL and STEP_WAVE, 8 for STEP_HALF
+    uint8_t drive_mode;            // STEP_FULL, STEP_HALF or STEP_WAVE
+    uint8_t phase;                 // current index into phase_table
+#if WMS_ENABLE_CURRENT_SENSE
+    uint16_t phase_baseline[8];    // learned free-running coil current for each phase
+    uint16_t stall_threshold;      // current rise above baseline that marks a stalled step
+    uint8_t stall_steps;           // stalled steps in a row needed to report a stall
+    uint8_t stall_count;           // stalled steps in a row seen so far
+    uint16_t last_current;         // coil current sampled after the last phase change
+#endif
+    uint8_t run_duty;              // coil PWM while stepping
+    uint8_t accel_duty;            // coil PWM for the first steps after idle
+    uint8_t accel_steps;           // number of steps after idle that use accel_duty
+    uint8_t hold_duty;             // coil PWM while idle with hold_brake == BRAKE_OFF
+    uint8_t hold_brake;            // BRAKE_OFF, BRAKE_SOFT or BRAKE_HARD while idle
+    uint16_t idle_timeout;         // ms without a step before holding, 0 = never
+    uint8_t steps_since_idle;      // steps taken since leaving idle, saturates at accel_steps
+    uint8_t holding;               // non-zero while the hold state is applied
+    uint8_t applied_duty;          // coil PWM currently written to m1 and m2
 
  public:
    Wicked_Stepper(uint16_t number_of_steps, uint8_t m1, uint8_t m2, uint8_t use_alternate_pins = 0);
    void setSpeed(uint32_t speed);
    void step(int16_t number_of_steps);
+   void setDriveMode(uint8_t mode);
+#if WMS_ENABLE_CURRENT_SENSE
+   void setStallThreshold(uint16_t threshold, uint8_t consecutive_steps = 2);
+   int32_t home(int16_t max_steps, uint16_t learn_steps = 8);
+   uint16_t getPhaseCurrent(void);
+#endif
+   void setRunDuty(uint8_t duty);
+   void setAccelDuty(uint8_t duty, uint8_t steps);
+   void setHoldDuty(uint8_t duty);
+   void setIdleTimeout(uint16_t timeout_ms, uint8_t hold_brake = BRAKE_OFF);
+   void update(void);
 };
+#endif /* WMS_ENABLE_STEPPER */
 
-
+#if WMS_ENABLE_DCMOTOR
 class Wicked_DCMotor : public WickedMotorShield {
  private:
    uint8_t get_motor_direction(void);  
    uint8_t motor_number;
+#if WMS_ENABLE_BEMF
+   uint8_t bemf_pin;              // analog input sampling the motor terminal
+   uint16_t bemf_interval;        // ms between back-EMF measurements, 0 = disabled
+   uint16_t bemf_settle_us;       // coast time before sampling
+   uint16_t rpm_per_count;        // 8.8 fixed point ADC count to RPM factor
+   uint32_t bemf_last_measure;    // millis() of this motor's last measurement
+   uint16_t speed_estimate;       // last estimate in RPM
+   uint16_t bemf_overhead_us;     // length of the last measurement window
+   static uint8_t bemf_channels;
+   static uint32_t bemf_last_window;
+#endif
+#if WMS_ENABLE_ENCODER
+   uint8_t encoder;               // slot in WickedMotorShield#encoders, 0xff = none
+   uint8_t moving;                // non-zero while moveTo() is in progress
+   uint8_t max_speed;             // speed limit of the current move
+   uint8_t tolerance;             // counts from the target that count as arrived
+   uint8_t position_gain;         // 4.4 fixed point, speed per count of error
+   int32_t target;                // target position of the current move
+   int32_t velocity_position;     // position at the start of the velocity window
+   uint32_t velocity_time;        // micros() at the start of the velocity window
+   int32_t velocity;              // counts per second over the last window
+#endif
  public:
    Wicked_DCMotor(uint8_t motor_number, uint8_t use_alternate_pins = 0);
    /**
@@ -262,6 +552,9 @@ class Wicked_DCMotor : public WickedMotorShield {
     *   @param pwm_val Value for speed with an integer in the range 0 to 255.
     */
    void setSpeed(uint8_t pwm_val);            // 0..255
+#if WMS_ENABLE_PWM_CONFIG
+   void setSpeedFine(uint16_t duty);          // 0..65535
+#endif
    /**
     *   Set the direction of rotation of the motor.
     */
@@ -277,8 +570,63 @@ class Wicked_DCMotor : public WickedMotorShield {
     *   applied to DC motor.
     */
    void setBrake(uint8_t brake_type);         // BRAKE_HARD, BRAKE_SOFT, BRAKE_OFF
+   uint8_t getMotorNumber(void);
+#if WMS_ENABLE_CURRENT_SENSE
    uint16_t currentSense(void);
+   void setOversampling(uint8_t extra_bits);
+   uint16_t getSampleRate(void);
+#endif
+#if WMS_ENABLE_BEMF
+   void setBackEMF(uint8_t analog_pin, uint16_t rpm_per_count, uint16_t interval_ms, uint16_t settle_us = 500);
+   uint8_t updateSpeedEstimate(void);
+   uint16_t getSpeedEstimate(void);
+   uint16_t getMeasurementOverhead(void);
+#endif
+#if WMS_ENABLE_ENCODER
+   uint8_t attachEncoder(uint8_t pin_a = 0xff, uint8_t pin_b = 0xff);
+   int32_t getPosition(void);
+   void setPosition(int32_t position);
+   int32_t getVelocity(void);
+   void setPositionGain(uint8_t gain);
+   void moveTo(int32_t target, uint8_t max_speed = 255, uint8_t tolerance = 2);
+   uint8_t updatePosition(void);
+   uint8_t isMoving(void);
+#endif
 };
+#endif /* WMS_ENABLE_DCMOTOR */
+
+#if WMS_ENABLE_DCMOTOR && WMS_ENABLE_RCIN
+class Wicked_RCMixer : public WickedMotorShield {
+ private:
+   int16_t shape(uint16_t width);
+   void apply(int16_t left, int16_t right);
+   void apply_failsafe(void);
+
+   uint8_t mode;                  // MIX_TANK or MIX_ARCADE
+   uint8_t motors[6];             // motor numbers of the attached channels
+   uint8_t sides;                 // bit n set if motors[n] is on the right side
+   uint8_t reversed;              // bit n set if motors[n] runs reversed
+   uint8_t motor_count;           // number of attached channels
+   uint16_t center_us;            // pulse width for a centered stick
+   uint16_t range_us;             // pulse width change for full stick
+   uint16_t deadband_us;          // pulse width change around center treated as 0
+   uint16_t scale;                // 8.8 fixed point, stick us beyond deadband to -255..255
+   uint8_t expo;                  // 0 = linear .. 255 = cubic
+   uint16_t failsafe_ms;          // time without a valid frame before failsafe
+   uint8_t failsafe_brake;        // brake applied in failsafe
+   uint8_t failsafe_active;       // non-zero while failsafe is applied
+   uint32_t last_frame;           // millis() of the last valid frame
+   int16_t command[2];            // last left and right commands
+ public:
+   Wicked_RCMixer(uint8_t mode = MIX_ARCADE);
+   void attach(Wicked_DCMotor & motor, uint8_t side, uint8_t reverse = 0);
+   void setCalibration(uint16_t center_us, uint16_t range_us, uint16_t deadband_us);
+   void setExpo(uint8_t expo);
+   void setFailsafe(uint16_t timeout_ms, uint8_t brake_type = BRAKE_SOFT);
+   uint8_t update(void);
+   int16_t getCommand(uint8_t side);
+};
+#endif
 
 #endif /* _WICKED_MOTOR_SHIELD_H */
 
@@ -0,0 +1,105 @@
+/** @file
+ *  Compile-time options for the Wicked Motor Shield library.
+ *
+ *  The Arduino IDE compiles the library separately from the sketch, so a
+ *  \#define in the sketch does not reach these settings.  Change them here,
+ *  or pass them as compiler flags (for example -DWMS_TRACE_DEPTH=64 in
+ *  compiler.cpp.extra_flags).
+ */
+/* Copyright (C) 2014 by Victor Aprea <victor.aprea@wickeddevice.com>
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be
+included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.  */
+
+#ifndef _WICKED_MOTOR_SHIELD_CONFIG_H
+#define _WICKED_MOTOR_SHIELD_CONFIG_H
+
+/**
+ *  Feature switches.  Set any of these to 0 to leave the subsystem out of
+ *  the build: its functions, its static data and the members it adds to
+ *  every motor object.  extras/size_report.sh shows what each one costs.
+ */
+/** Wicked_Stepper, including the phase tables and idle current control. */
+#ifndef WMS_ENABLE_STEPPER
+#define WMS_ENABLE_STEPPER (1)
+#endif
+/** Wicked_DCMotor. */
+#ifndef WMS_ENABLE_DCMOTOR
+#define WMS_ENABLE_DCMOTOR (1)
+#endif
+/** RC inputs: getRCIN(), getRCINWidth() and, with Wicked_DCMotor, Wicked_RCMixer. */
+#ifndef WMS_ENABLE_RCIN
+#define WMS_ENABLE_RCIN (1)
+#endif
+/** Current sensing, oversampling and stepper stall homing. */
+#ifndef WMS_ENABLE_CURRENT_SENSE
+#define WMS_ENABLE_CURRENT_SENSE (1)
+#endif
+/** Back-EMF speed estimation for Wicked_DCMotor. */
+#ifndef WMS_ENABLE_BEMF
+#define WMS_ENABLE_BEMF (1)
+#endif
+/** PWM carrier frequency and fine duty control. */
+#ifndef WMS_ENABLE_PWM_CONFIG
+#define WMS_ENABLE_PWM_CONFIG (1)
+#endif
+
+/**
+ *  Number of events kept by the shift register and PWM trace recorder.
+ *
+ *  Must be 0 (recorder compiled out) or a power of two no larger than 256.
+ *  Each event takes 7 bytes of RAM.  See WickedMotorShield::dumpTrace()
+ *  and extras/trace_decode.py.
+ */
+#ifndef WMS_TRACE_DEPTH
+#define WMS_TRACE_DEPTH (0)
+#endif
+
+/**
+ *  Set to 1 to measure the RC inputs with a pin change interrupt instead of
+ *  the blocking pulseIn() in WickedMotorShield::getRCIN().
+ *
+ *  Needed by Wicked_RCMixer for low latency.  The library then defines the
+ *  PCINT interrupt vectors, so it cannot be combined with other libraries
+ *  that define them, such as SoftwareSerial.  AVR boards only.
+ */
+#ifndef WMS_RCIN_CAPTURE
+#define WMS_RCIN_CAPTURE (0)
+#endif
+
+/**
+ *  Set to 1 to decode quadrature encoders on Wicked_DCMotor channels, see
+ *  Wicked_DCMotor::attachEncoder().
+ *
+ *  Like #WMS_RCIN_CAPTURE this defines the PCINT interrupt vectors.  The
+ *  two may be enabled together; an encoder attached to RCIN1_PIN or
+ *  RCIN2_PIN takes that pin away from RC capture.  AVR boards only.
+ */
+#ifndef WMS_ENABLE_ENCODER
+#define WMS_ENABLE_ENCODER (0)
+#endif
+/**
+ *  Number of encoders that can be attached at once.  Each takes 11 bytes
+ *  of RAM and a little time in the pin change interrupt.
+ */
+#ifndef WMS_ENCODER_COUNT
+#define WMS_ENCODER_COUNT (2)
+#endif
+
+#endif /* _WICKED_MOTOR_SHIELD_CONFIG_H */
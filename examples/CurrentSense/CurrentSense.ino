@@ -1,6 +1,6 @@
 #include <WickedMotorShield.h>
 
-#define RING_BUFFER_DEPTH 16
+#define OVERSAMPLE_BITS 2 // 16 samples per reading, 12-bit results
 #define NUM_MOTORS 4
 Wicked_DCMotor motor1(M1);
 Wicked_DCMotor motor2(M2);
@@ -22,52 +22,35 @@ Wicked_DCMotor *m[] = {&motor1, &motor2, &motor3, &motor4, &motor5, &motor6};
 const char *   m_headings[] = {"M1", "M2", "M3", "M4", "M5", "M6"};
 */
 
-uint16_t ring_buffers[NUM_MOTORS][RING_BUFFER_DEPTH];
-uint8_t  ring_buffer_index;
-
-uint32_t ringBufferAverage(uint8_t index);
-
 void setup(void){
   Serial.begin(115200);
+  WickedMotorShield::begin(); // set up the shield pins once for all motors
   Serial.print(F("Wicked Motor Shield Library version "));
   Serial.print(WickedMotorShield::version());
   Serial.println(F("- Current Sensing"));
+
+  // no reading may take longer than 10 ms
+  WickedMotorShield::setSenseBudget(10000);
+
   for(int ii = 0; ii < NUM_MOTORS; ii++){
     Serial.print(m_headings[ii]);
     Serial.print(F("\t"));
     m[ii]->setDirection(DIR_CW);
     m[ii]->setSpeed(255);
     m[ii]->setBrake(BRAKE_OFF);
+    m[ii]->setOversampling(OVERSAMPLE_BITS);
   }
-  Serial.println();
+  Serial.println(F("(samples/s)"));
 }
 
 void loop(void){
-  // store current samples on each motor
+  // print a row of oversampled readings
   for(int ii = 0; ii < NUM_MOTORS; ii++){
-    ring_buffers[ii][ring_buffer_index] = m[ii]->currentSense();
-  }
-
-  // update and wrap the ring_buffer_index
-  ring_buffer_index++;
-  if(ring_buffer_index == RING_BUFFER_DEPTH){
-    ring_buffer_index = 0;
-  }
-  
-  // print a row of the moving average
-  for(int ii = 0; ii < NUM_MOTORS; ii++){
-    Serial.print(ringBufferAverage(ii));
+    Serial.print(m[ii]->currentSense());
     Serial.print(F("\t"));
   }
-  Serial.println();
+  Serial.print(F("("));
+  Serial.print(m[0]->getSampleRate());
+  Serial.println(F(")"));
   delay(100);
 }
-
-uint32_t ringBufferAverage(uint8_t index){
-  uint32_t sum = 0;
-  for(int ii = 0; ii < RING_BUFFER_DEPTH; ii++){
-    sum += ring_buffers[index][ii];
-  }
-  
-  return (sum / RING_BUFFER_DEPTH);
-}
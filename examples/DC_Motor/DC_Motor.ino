@@ -23,11 +23,12 @@ Wicked_DCMotor *m[] = {&motor1, &motor2, &motor3, &motor4, &motor5, &motor6};
 
 void setup(void){
   Serial.begin(115200);
+  WickedMotorShield::begin(); // set up the shield pins once for all motors
   Serial.print(F("Wicked Motor Shield Library version "));
   Serial.print(WickedMotorShield::version());
   Serial.println(F("- DC Motors"));
   
-  // note, library initialized all motors to a clockwise direction and brake condition
+  // note, begin() initialized all motors to a clockwise direction and brake condition
 }
 
 void loop(void){
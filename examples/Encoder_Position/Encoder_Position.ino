@@ -0,0 +1,40 @@
+#include <WickedMotorShield.h>
+
+// Wire the encoder's A and B outputs to RCIN1 and RCIN2, and set
+// WMS_ENABLE_ENCODER to 1 in WickedMotorShieldConfig.h.
+#if !WMS_ENABLE_ENCODER
+#error "Set WMS_ENABLE_ENCODER to 1 in WickedMotorShieldConfig.h"
+#endif
+
+const int32_t countsPerRevolution = 48; // four counts per encoder line, times the gear ratio
+
+Wicked_DCMotor motor(M1);
+
+void setup(){
+  Serial.begin(115200);
+  WickedMotorShield::begin(); // set up the shield pins once for all motors
+  Serial.print(F("Wicked Motor Shield Library version "));
+  Serial.print(WickedMotorShield::version());
+  Serial.println(F("- Encoder Position"));
+
+  if(!motor.attachEncoder()){ // defaults to RCIN1 and RCIN2
+    Serial.println(F("Encoder not available"));
+  }
+  motor.setPositionGain(24); // 1.5 speed steps per count of error
+}
+
+void loop(void){
+  // one revolution forward, then back
+  motor.moveTo(countsPerRevolution, 200);
+  while(!motor.updatePosition()){
+    Serial.print(motor.getPosition());
+    Serial.print(F("\t"));
+    Serial.println(motor.getVelocity());
+  }
+  delay(1000);
+
+  motor.moveTo(0, 200);
+  while(!motor.updatePosition()){
+  }
+  delay(1000);
+}
@@ -0,0 +1,31 @@
+#include <WickedMotorShield.h>
+
+// For the lowest latency set WMS_RCIN_CAPTURE to 1 in WickedMotorShieldConfig.h.
+// Without it, update() measures the RC inputs with the blocking pulseIn().
+
+Wicked_DCMotor left_motor(M1);
+Wicked_DCMotor right_motor(M2);
+
+Wicked_RCMixer mixer(MIX_ARCADE); // RCIN1 throttle, RCIN2 steering
+
+void setup(void){
+  Serial.begin(115200);
+  WickedMotorShield::begin(); // set up the shield pins once for all motors
+  Serial.print(F("Wicked Motor Shield Library version "));
+  Serial.print(WickedMotorShield::version());
+  Serial.println(F("- RC Mixer"));
+
+  mixer.attach(left_motor, MIX_LEFT);
+  mixer.attach(right_motor, MIX_RIGHT, 1); // right motor is mounted mirror image
+  mixer.setCalibration(1500, 500, 20);     // center, full stick, deadband in microseconds
+  mixer.setExpo(64);                       // a little softer around center
+  mixer.setFailsafe(100, BRAKE_HARD);      // stop if the receiver goes quiet for 100 ms
+}
+
+void loop(void){
+  if(mixer.update()){
+    Serial.print(mixer.getCommand(MIX_LEFT));
+    Serial.print(F("\t"));
+    Serial.println(mixer.getCommand(MIX_RIGHT));
+  }
+}
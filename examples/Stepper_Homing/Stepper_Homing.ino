@@ -0,0 +1,35 @@
+#include <WickedMotorShield.h>
+
+const int stepsPerRevolution = 200;  // change this to fit the number of steps per revolution
+                                     // for your motor
+
+Wicked_Stepper stepper(stepsPerRevolution, M1, M2);
+
+void setup(){
+  Serial.begin(115200);
+  WickedMotorShield::begin(); // set up the shield pins once for all motors
+  Serial.print(F("Wicked Motor Shield Library version "));
+  Serial.print(WickedMotorShield::version());
+  Serial.println(F("- Stepper Homing"));
+
+  stepper.setSpeed(30);              // home slowly
+  stepper.setStallThreshold(100, 2); // tune for your motor, see getPhaseCurrent()
+
+  // move counter clockwise until the axis hits its mechanical stop
+  int32_t steps = stepper.home(-2 * stepsPerRevolution);
+  if(steps < 0){
+    Serial.println(F("No stall detected"));
+  }
+  else{
+    Serial.print(F("Homed after "));
+    Serial.print(steps);
+    Serial.println(F(" steps"));
+  }
+}
+
+void loop(void){
+  stepper.step(50);
+  delay(1000);
+  stepper.step(-50);
+  delay(1000);
+}
@@ -9,9 +9,14 @@ int stepCount = 0;         // number of steps the motor has taken
 
 void setup(){
   Serial.begin(115200);
+  WickedMotorShield::begin(); // set up the shield pins once for all motors
   Serial.print(F("Wicked Motor Shield Library version "));
   Serial.print(WickedMotorShield::version());
   Serial.println(F("- Stepper Motors")); 
+
+  // drop to half current while waiting between steps
+  stepper.setHoldDuty(127);
+  stepper.setIdleTimeout(250);
 }
 
 void loop(void){
@@ -20,4 +25,5 @@ void loop(void){
   Serial.println(stepCount);
   stepCount++;
   delay(500);
+  stepper.update(); // applies the hold duty once the motor has been idle for 250 ms
 }
@@ -0,0 +1,195 @@
+/* Host stand-in for the Arduino core, modelling an Uno (ATmega328P).
+
+Lets WickedMotorShield.cpp and example sketches build and run with the
+host C++ compiler.  Time is simulated: it only advances when the code
+calls a function that takes time on the real board, such as delay(),
+micros() or analogRead().  The shift register latch, the PWM outputs, the
+timer and pin change registers and the ADC are modelled closely enough for
+the library; host_hal.h gives tests and simulators access to them.
+
+Build with -DARDUINO=10800 -Iextras/host, see extras/host/run_tests.sh.  */
+
+#ifndef _WMS_HOST_ARDUINO_H
+#define _WMS_HOST_ARDUINO_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef __AVR_ATmega328P__
+#define __AVR_ATmega328P__
+#endif
+#ifndef F_CPU
+#define F_CPU 16000000UL
+#endif
+
+#define HIGH 0x1
+#define LOW  0x0
+#define INPUT 0x0
+#define OUTPUT 0x1
+#define INPUT_PULLUP 0x2
+#define LSBFIRST 0
+#define MSBFIRST 1
+#define DEC 10
+#define HEX 16
+
+#define A0 (14)
+#define A1 (15)
+#define A2 (16)
+#define A3 (17)
+#define A4 (18)
+#define A5 (19)
+#define A6 (20)
+#define A7 (21)
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+template<class T> T min(T a, T b){ return (a < b) ? a : b; }
+template<class T> T max(T a, T b){ return (a > b) ? a : b; }
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+// ---- status register, the I bit gates the simulated interrupts ----
+class HostSREG{
+ public:
+  operator uint8_t() const { return value; }
+  HostSREG & operator=(uint8_t new_value);
+  uint8_t value;
+};
+extern HostSREG SREG;
+void cli(void);
+void sei(void);
+#define noInterrupts() cli()
+#define interrupts() sei()
+
+// ---- timers, as the Arduino core leaves them after init() ----
+extern volatile uint8_t TCCR0A, TCCR0B, TCNT0, OCR0A, OCR0B, TIFR0, TIMSK0;
+extern volatile uint8_t TCCR1A, TCCR1B;
+extern volatile uint16_t TCNT1, ICR1, OCR1A, OCR1B;
+extern volatile uint8_t TCCR2A, TCCR2B, TCNT2, OCR2A, OCR2B;
+extern volatile unsigned long timer0_overflow_count;
+#define TCNT0 TCNT0   // registers are macros on the AVR, code tests for them
+#define TIFR0 TIFR0
+
+#define CS00 0
+#define CS01 1
+#define CS02 2
+#define WGM00 0
+#define WGM01 1
+#define WGM02 3
+#define COM0B0 4
+#define COM0B1 5
+#define COM0A0 6
+#define COM0A1 7
+#define TOV0 0
+#define CS10 0
+#define CS11 1
+#define CS12 2
+#define WGM10 0
+#define WGM11 1
+#define WGM12 3
+#define WGM13 4
+#define COM1B0 4
+#define COM1B1 5
+#define COM1A0 6
+#define COM1A1 7
+#define CS20 0
+#define CS21 1
+#define CS22 2
+#define WGM20 0
+#define WGM21 1
+#define WGM22 3
+#define COM2B0 4
+#define COM2B1 5
+#define COM2A0 6
+#define COM2A1 7
+
+#define _BV(bit) (1 << (bit))
+
+#define NOT_ON_TIMER 0
+#define TIMER0A 1
+#define TIMER0B 2
+#define TIMER1A 3
+#define TIMER1B 4
+#define TIMER2  6
+#define TIMER2A 7
+#define TIMER2B 8
+uint8_t digitalPinToTimer(uint8_t pin);
+
+// ---- ports and pin change interrupts, Uno pin mapping ----
+#define NOT_A_PIN 0
+#define NOT_A_PORT 0
+#define PB 2
+#define PC 3
+#define PD 4
+extern volatile uint8_t PINB, PINC, PIND;
+extern volatile uint8_t PCICR, PCIFR, PCMSK0, PCMSK1, PCMSK2;
+#define PCICR PCICR
+#define PCIE0 0
+#define PCIE1 1
+#define PCIE2 2
+
+#define digitalPinToPort(p) (((p) <= 7) ? PD : (((p) <= 13) ? PB : (((p) <= 19) ? PC : NOT_A_PIN)))
+#define digitalPinToBitMask(p) ((uint8_t) _BV(((p) <= 7) ? (p) : (((p) <= 13) ? ((p) - 8) : ((p) - 14))))
+#define portInputRegister(port) (((port) == PB) ? &PINB : (((port) == PC) ? &PINC : (((port) == PD) ? &PIND : (volatile uint8_t *) 0)))
+#define digitalPinToPCICR(p) (((p) <= 21) ? (&PCICR) : ((volatile uint8_t *) 0))
+#define digitalPinToPCICRbit(p) (((p) <= 7) ? 2 : (((p) <= 13) ? 0 : 1))
+#define digitalPinToPCMSK(p) (((p) <= 7) ? (&PCMSK2) : (((p) <= 13) ? (&PCMSK0) : (((p) <= 21) ? (&PCMSK1) : ((volatile uint8_t *) 0))))
+#define digitalPinToPCMSKbit(p) (((p) <= 7) ? (p) : (((p) <= 13) ? ((p) - 8) : ((p) - 14)))
+
+// interrupt vectors are plain C functions the host HAL calls
+#define PCINT0_vect PCINT0_vect
+#define PCINT1_vect PCINT1_vect
+#define PCINT2_vect PCINT2_vect
+#define ISR(vector, ...) extern "C" void vector(void) __VA_ARGS__
+#define ISR_ALIASOF(vector) __attribute__((alias(#vector)))
+
+// ---- core functions ----
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+int digitalRead(uint8_t pin);
+int analogRead(uint8_t pin);
+void analogWrite(uint8_t pin, int value);
+void shiftOut(uint8_t data_pin, uint8_t clock_pin, uint8_t bit_order, uint8_t value);
+unsigned long pulseIn(uint8_t pin, uint8_t state, unsigned long timeout = 1000000L);
+unsigned long millis(void);
+unsigned long micros(void);
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+
+// ---- printing ----
+#define F(string_literal) (string_literal)
+
+class Print{
+ public:
+  virtual ~Print(){}
+  virtual size_t write(uint8_t c) = 0;
+  size_t write(const char * str);
+  size_t print(const char * str);
+  size_t print(char c);
+  size_t print(unsigned char n, int base = DEC);
+  size_t print(int n, int base = DEC);
+  size_t print(unsigned int n, int base = DEC);
+  size_t print(long n, int base = DEC);
+  size_t print(unsigned long n, int base = DEC);
+  size_t print(double n, int digits = 2);
+  size_t println(void);
+  template<class T> size_t println(T value){ size_t n = print(value); return n + println(); }
+  template<class T> size_t println(T value, int base){ size_t n = print(value, base); return n + println(); }
+ private:
+  size_t print_number(unsigned long n, int base);
+};
+
+class HardwareSerial : public Print{
+ public:
+  void begin(unsigned long baud);
+  virtual size_t write(uint8_t c);
+  using Print::write;
+  int available(void){ return 0; }
+  int read(void){ return -1; }
+  operator bool(){ return true; }
+  unsigned long baud;
+};
+extern HardwareSerial Serial;
+
+#endif /* _WMS_HOST_ARDUINO_H */
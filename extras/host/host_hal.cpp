@@ -0,0 +1,572 @@
+/* Simulated Arduino Uno for host builds, see Arduino.h and host_hal.h.
+
+Time costs of the core functions are rough figures for a 16 MHz Uno; they
+keep busy-wait loops finite and make the library's timing measurements
+come out in the right range.  */
+
+#include <stdio.h>
+#include "host_hal.h"
+
+#define PIN_COUNT        (22)
+#define SHIELD_LATCH_PIN (7)   // SERIAL_LATCH_PIN of the motor shield
+
+#define COST_MICROS        (4)
+#define COST_DIGITAL_IO    (4)
+#define COST_ANALOG_WRITE  (8)
+#define COST_SHIFT_OUT     (84)   // 8 bits of three digitalWrite() calls
+#define COST_ANALOG_READ   (112)  // 13 ADC clocks at 125 kHz plus overhead
+#define RC_FRAME_US        (20000)
+#define SERIAL_TX_BUFFER   (64)
+
+HostSREG SREG = {0x80}; // init() enables interrupts
+
+volatile uint8_t TCCR0A = _BV(WGM01) | _BV(WGM00); // fast PWM, millis()
+volatile uint8_t TCCR0B = _BV(CS01) | _BV(CS00);   // clk/64
+volatile uint8_t TCNT0 = 0;
+volatile uint8_t OCR0A = 0;
+volatile uint8_t OCR0B = 0;
+volatile uint8_t TIFR0 = 0;
+volatile uint8_t TIMSK0 = 0x01;
+volatile uint8_t TCCR1A = _BV(WGM10);              // phase correct 8-bit
+volatile uint8_t TCCR1B = _BV(CS11) | _BV(CS10);   // clk/64
+volatile uint16_t TCNT1 = 0;
+volatile uint16_t ICR1 = 0;
+volatile uint16_t OCR1A = 0;
+volatile uint16_t OCR1B = 0;
+volatile uint8_t TCCR2A = _BV(WGM20);              // phase correct
+volatile uint8_t TCCR2B = _BV(CS22);               // clk/64
+volatile uint8_t TCNT2 = 0;
+volatile uint8_t OCR2A = 0;
+volatile uint8_t OCR2B = 0;
+volatile unsigned long timer0_overflow_count = 0;
+
+volatile uint8_t PINB = 0;
+volatile uint8_t PINC = 0;
+volatile uint8_t PIND = 0;
+volatile uint8_t PCICR = 0;
+volatile uint8_t PCIFR = 0;
+volatile uint8_t PCMSK0 = 0;
+volatile uint8_t PCMSK1 = 0;
+volatile uint8_t PCMSK2 = 0;
+
+HardwareSerial Serial;
+
+uint8_t host_shift_register[2] = {0, 0};
+uint32_t host_latch_count = 0;
+void (*host_latch_hook)(void) = 0;
+void (*host_pwm_hook)(uint8_t pin, uint16_t duty) = 0;
+uint16_t (*host_analog_hook)(uint8_t pin) = 0;
+void (*host_time_hook)(uint64_t now_us) = 0;
+FILE * host_serial_file = 0;
+
+extern "C" void PCINT0_vect(void) __attribute__((weak));
+extern "C" void PCINT1_vect(void) __attribute__((weak));
+extern "C" void PCINT2_vect(void) __attribute__((weak));
+
+static uint64_t now_us = 0;
+static uint8_t in_time_hook = 0;
+static uint8_t in_isr = 0;
+static uint8_t pin_mode[PIN_COUNT];
+static uint8_t out_level[PIN_COUNT];
+static int8_t driven[PIN_COUNT] = {-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                                   -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1};
+static uint8_t level[PIN_COUNT];
+static uint16_t reported_duty[PIN_COUNT];
+static uint16_t analog_value[8];
+static uint32_t pulse_width[PIN_COUNT];
+static uint8_t shifted[2];
+static uint64_t serial_free_at = 0;
+
+// ---- interrupts ----
+
+static void run_interrupts(void){
+  if(!(SREG.value & 0x80) || in_isr){
+    return;
+  }
+  // PCINT0 has the highest priority
+  static void (* const vectors[3])(void) = {PCINT0_vect, PCINT1_vect, PCINT2_vect};
+  uint8_t pending;
+  while((pending = PCIFR & PCICR) != 0){
+    uint8_t bit = 0;
+    while(!(pending & _BV(bit))){
+      bit++;
+    }
+    PCIFR &= ~_BV(bit);
+    in_isr = 1;
+    SREG.value &= ~0x80;
+    if(vectors[bit]){
+      vectors[bit]();
+    }
+    SREG.value |= 0x80;
+    in_isr = 0;
+  }
+}
+
+HostSREG & HostSREG::operator=(uint8_t new_value){
+  value = new_value;
+  run_interrupts();
+  return *this;
+}
+
+void cli(void){
+  SREG.value &= ~0x80;
+}
+
+void sei(void){
+  SREG = SREG.value | 0x80;
+}
+
+// ---- pins ----
+
+static void update_pin(uint8_t pin){
+  uint8_t new_level;
+  if(pin_mode[pin] == OUTPUT){
+    new_level = out_level[pin];
+  }
+  else if(driven[pin] >= 0){
+    new_level = driven[pin];
+  }
+  else{
+    new_level = (pin_mode[pin] == INPUT_PULLUP) ? 1 : 0;
+  }
+  if(new_level == level[pin]){
+    return;
+  }
+  level[pin] = new_level;
+
+  volatile uint8_t * reg = portInputRegister(digitalPinToPort(pin));
+  uint8_t mask = digitalPinToBitMask(pin);
+  if(new_level){
+    *reg |= mask;
+  }
+  else{
+    *reg &= ~mask;
+  }
+  if(*digitalPinToPCMSK(pin) & _BV(digitalPinToPCMSKbit(pin))){
+    PCIFR |= _BV(digitalPinToPCICRbit(pin));
+    run_interrupts();
+  }
+}
+
+uint8_t digitalPinToTimer(uint8_t pin){
+  switch(pin){
+  case 3:  return TIMER2B;
+  case 5:  return TIMER0B;
+  case 6:  return TIMER0A;
+  case 9:  return TIMER1A;
+  case 10: return TIMER1B;
+  case 11: return TIMER2A;
+  }
+  return NOT_ON_TIMER;
+}
+
+// compare output mode bits of a pin's timer channel, 0 when disconnected
+static uint8_t compare_mode(uint8_t timer){
+  switch(timer){
+  case TIMER0A: return (TCCR0A >> COM0A0) & 0x03;
+  case TIMER0B: return (TCCR0A >> COM0B0) & 0x03;
+  case TIMER1A: return (TCCR1A >> COM1A0) & 0x03;
+  case TIMER1B: return (TCCR1A >> COM1B0) & 0x03;
+  case TIMER2A: return (TCCR2A >> COM2A0) & 0x03;
+  case TIMER2B: return (TCCR2A >> COM2B0) & 0x03;
+  }
+  return 0;
+}
+
+static void disconnect_compare(uint8_t timer){
+  switch(timer){
+  case TIMER0A: TCCR0A &= ~_BV(COM0A1); break;
+  case TIMER0B: TCCR0A &= ~_BV(COM0B1); break;
+  case TIMER1A: TCCR1A &= ~_BV(COM1A1); break;
+  case TIMER1B: TCCR1A &= ~_BV(COM1B1); break;
+  case TIMER2A: TCCR2A &= ~_BV(COM2A1); break;
+  case TIMER2B: TCCR2A &= ~_BV(COM2B1); break;
+  }
+}
+
+/* Waveform of a timer channel: TOP, compare value, prescaler and whether
+ * the mode is fast (single slope) PWM.  Returns 0 if the channel does not
+ * produce PWM in its current mode. */
+static uint8_t timer_waveform(uint8_t timer, uint32_t * top, uint32_t * ocr, uint32_t * prescaler, uint8_t * fast){
+  static const uint16_t prescalers01[8] = {0, 1, 8, 64, 256, 1024, 0, 0};
+  static const uint16_t prescalers2[8] = {0, 1, 8, 32, 64, 128, 256, 1024};
+  uint8_t channel_b = (timer == TIMER0B || timer == TIMER1B || timer == TIMER2B);
+
+  if(timer == TIMER0A || timer == TIMER0B || timer == TIMER2A || timer == TIMER2B){
+    uint8_t is_timer0 = (timer == TIMER0A || timer == TIMER0B);
+    uint8_t a = is_timer0 ? TCCR0A : TCCR2A;
+    uint8_t b = is_timer0 ? TCCR0B : TCCR2B;
+    uint8_t wgm = (a & 0x03) | ((b >> 1) & 0x04);
+    *prescaler = is_timer0 ? prescalers01[b & 0x07] : prescalers2[b & 0x07];
+    uint32_t ocr_a = is_timer0 ? OCR0A : OCR2A;
+    *ocr = channel_b ? (is_timer0 ? OCR0B : OCR2B) : ocr_a;
+    switch(wgm){
+    case 1: *top = 0xff; *fast = 0; return 1;
+    case 3: *top = 0xff; *fast = 1; return 1;
+    case 5: *top = ocr_a; *fast = 0; return channel_b;
+    case 7: *top = ocr_a; *fast = 1; return channel_b;
+    }
+    return 0;
+  }
+
+  if(timer == TIMER1A || timer == TIMER1B){
+    uint8_t wgm = (TCCR1A & 0x03) | ((TCCR1B >> 1) & 0x0c);
+    *prescaler = prescalers01[TCCR1B & 0x07];
+    *ocr = channel_b ? OCR1B : OCR1A;
+    switch(wgm){
+    case 1:  *top = 0xff;  *fast = 0; return 1;
+    case 2:  *top = 0x1ff; *fast = 0; return 1;
+    case 3:  *top = 0x3ff; *fast = 0; return 1;
+    case 5:  *top = 0xff;  *fast = 1; return 1;
+    case 6:  *top = 0x1ff; *fast = 1; return 1;
+    case 7:  *top = 0x3ff; *fast = 1; return 1;
+    case 8:
+    case 10: *top = ICR1;  *fast = 0; return 1;
+    case 9:
+    case 11: *top = OCR1A; *fast = 0; return channel_b;
+    case 14: *top = ICR1;  *fast = 1; return 1;
+    case 15: *top = OCR1A; *fast = 1; return channel_b;
+    }
+  }
+  return 0;
+}
+
+uint16_t host_pwm_duty(uint8_t pin){
+  if(pin >= PIN_COUNT){
+    return 0;
+  }
+  uint8_t timer = digitalPinToTimer(pin);
+  uint8_t mode = compare_mode(timer);
+  uint32_t top, ocr, prescaler;
+  uint8_t fast;
+
+  if(pin_mode[pin] != OUTPUT){
+    return 0;
+  }
+  if(mode < 2 || !timer_waveform(timer, &top, &ocr, &prescaler, &fast) || prescaler == 0 || top == 0){
+    return out_level[pin] ? 0xffff : 0;
+  }
+
+  uint32_t duty;
+  if(fast){
+    duty = (ocr >= top) ? 0xffff : (uint32_t) ((ocr + 1) * 65535ULL / (top + 1));
+  }
+  else{
+    duty = (ocr >= top) ? 0xffff : (uint32_t) (ocr * 65535ULL / top);
+  }
+  if(mode == 3){
+    duty = 0xffff - duty; // inverting output
+  }
+  return duty;
+}
+
+uint32_t host_pwm_frequency(uint8_t pin){
+  uint8_t timer = digitalPinToTimer(pin);
+  uint32_t top, ocr, prescaler;
+  uint8_t fast;
+
+  if(compare_mode(timer) < 2 || !timer_waveform(timer, &top, &ocr, &prescaler, &fast) || prescaler == 0 || top == 0){
+    return 0;
+  }
+  if(fast){
+    return F_CPU / (prescaler * (top + 1));
+  }
+  return F_CPU / (2 * prescaler * top);
+}
+
+// report output duty changes made since the last call
+static void poll_outputs(void){
+  for(uint8_t pin = 0; pin < PIN_COUNT; pin++){
+    if(pin_mode[pin] != OUTPUT){
+      continue;
+    }
+    uint16_t duty = host_pwm_duty(pin);
+    if(duty != reported_duty[pin]){
+      reported_duty[pin] = duty;
+      if(host_pwm_hook){
+        host_pwm_hook(pin, duty);
+      }
+    }
+  }
+}
+
+// ---- time ----
+
+uint64_t host_time_us(void){
+  return now_us;
+}
+
+// Timer0 counts in whatever mode setPWMFrequency() left it; the core's
+// overflow interrupt is modelled by timer0_overflow_count, micros() and
+// millis() stay exact
+static void run_timer0(uint32_t us){
+  static const uint16_t prescalers[8] = {0, 1, 8, 64, 256, 1024, 0, 0};
+  static uint32_t cycles = 0;   // CPU cycles not yet a timer count
+  static uint16_t position = 0; // counts into the current timer period
+  uint16_t prescaler = prescalers[TCCR0B & 0x07];
+  if(prescaler == 0){
+    return; // stopped
+  }
+  // fast PWM counts 0..255 and overflows at TOP, phase correct counts up
+  // and down again and overflows at BOTTOM
+  uint8_t phase_correct = (TCCR0A & (_BV(WGM01) | _BV(WGM00))) == _BV(WGM00);
+  uint16_t period = phase_correct ? 510 : 256;
+  uint64_t total = (uint64_t) us * (F_CPU / 1000000L) + cycles;
+  uint64_t counts = total / prescaler + position;
+  cycles = total % prescaler;
+  timer0_overflow_count += counts / period;
+  position = counts % period;
+  TCNT0 = (position < 256) ? position : period - position;
+}
+
+void host_advance_us(uint32_t us){
+  poll_outputs();
+  now_us += us;
+  run_timer0(us);
+  if(host_time_hook && !in_time_hook){
+    in_time_hook = 1;
+    host_time_hook(now_us);
+    in_time_hook = 0;
+  }
+}
+
+unsigned long micros(void){
+  host_advance_us(COST_MICROS);
+  return (uint32_t) now_us;
+}
+
+unsigned long millis(void){
+  host_advance_us(COST_MICROS);
+  return (uint32_t) (now_us / 1000);
+}
+
+void delay(unsigned long ms){
+  host_advance_us(ms * 1000);
+}
+
+void delayMicroseconds(unsigned int us){
+  host_advance_us(us);
+}
+
+// ---- core I/O ----
+
+void pinMode(uint8_t pin, uint8_t mode){
+  if(pin >= PIN_COUNT){
+    return;
+  }
+  pin_mode[pin] = mode;
+  if(mode != OUTPUT){
+    out_level[pin] = 0;
+  }
+  update_pin(pin);
+  host_advance_us(COST_DIGITAL_IO);
+}
+
+static void write_pin(uint8_t pin, uint8_t value){
+  disconnect_compare(digitalPinToTimer(pin));
+  uint8_t old_level = out_level[pin];
+  out_level[pin] = value ? 1 : 0;
+  if(pin_mode[pin] == INPUT && value){
+    pin_mode[pin] = INPUT_PULLUP; // writing HIGH to an input enables the pull-up
+  }
+  update_pin(pin);
+
+  if(pin == SHIELD_LATCH_PIN && pin_mode[pin] == OUTPUT && !old_level && value){
+    // the byte shifted out last sits in the register nearest the Arduino
+    host_shift_register[0] = shifted[1];
+    host_shift_register[1] = shifted[0];
+    host_latch_count++;
+    if(host_latch_hook){
+      host_latch_hook();
+    }
+  }
+}
+
+void digitalWrite(uint8_t pin, uint8_t value){
+  if(pin >= PIN_COUNT){
+    return;
+  }
+  write_pin(pin, value);
+  host_advance_us(COST_DIGITAL_IO);
+}
+
+int digitalRead(uint8_t pin){
+  host_advance_us(COST_DIGITAL_IO);
+  return (pin < PIN_COUNT) ? level[pin] : LOW;
+}
+
+void analogWrite(uint8_t pin, int value){
+  if(pin >= PIN_COUNT){
+    return;
+  }
+  pin_mode[pin] = OUTPUT;
+  if(value <= 0){
+    write_pin(pin, LOW);
+  }
+  else if(value >= 255){
+    write_pin(pin, HIGH);
+  }
+  else{
+    switch(digitalPinToTimer(pin)){
+    case TIMER0A: TCCR0A |= _BV(COM0A1); OCR0A = value; break;
+    case TIMER0B: TCCR0A |= _BV(COM0B1); OCR0B = value; break;
+    case TIMER1A: TCCR1A |= _BV(COM1A1); OCR1A = value; break;
+    case TIMER1B: TCCR1A |= _BV(COM1B1); OCR1B = value; break;
+    case TIMER2A: TCCR2A |= _BV(COM2A1); OCR2A = value; break;
+    case TIMER2B: TCCR2A |= _BV(COM2B1); OCR2B = value; break;
+    default:
+      write_pin(pin, (value < 128) ? LOW : HIGH);
+    }
+  }
+  host_advance_us(COST_ANALOG_WRITE);
+}
+
+int analogRead(uint8_t pin){
+  if(pin >= A0){
+    pin -= A0;
+  }
+  pin &= 0x07;
+  poll_outputs(); // the model must see the outputs as they are now
+  uint16_t counts = host_analog_hook ? host_analog_hook(A0 + pin) : analog_value[pin];
+  host_advance_us(COST_ANALOG_READ);
+  return (counts > 1023) ? 1023 : counts;
+}
+
+void shiftOut(uint8_t data_pin, uint8_t clock_pin, uint8_t bit_order, uint8_t value){
+  (void) data_pin;
+  (void) clock_pin;
+  (void) bit_order;
+  shifted[0] = shifted[1];
+  shifted[1] = value;
+  host_advance_us(COST_SHIFT_OUT);
+}
+
+unsigned long pulseIn(uint8_t pin, uint8_t state, unsigned long timeout){
+  (void) state;
+  uint32_t width = (pin < PIN_COUNT) ? pulse_width[pin] : 0;
+  if(width == 0 || timeout < RC_FRAME_US){
+    host_advance_us(timeout);
+    return 0;
+  }
+  host_advance_us(RC_FRAME_US);
+  return width;
+}
+
+// ---- host side ----
+
+void host_set_pin(uint8_t pin, uint8_t value){
+  if(pin >= PIN_COUNT){
+    return;
+  }
+  driven[pin] = value ? 1 : 0;
+  update_pin(pin);
+}
+
+uint8_t host_in_interrupt(void){
+  return in_isr;
+}
+
+uint8_t host_get_pin(uint8_t pin){
+  return (pin < PIN_COUNT) ? level[pin] : 0;
+}
+
+void host_set_analog(uint8_t pin, uint16_t counts){
+  if(pin >= A0){
+    pin -= A0;
+  }
+  analog_value[pin & 0x07] = counts;
+}
+
+void host_set_pulse(uint8_t pin, uint32_t width_us){
+  if(pin < PIN_COUNT){
+    pulse_width[pin] = width_us;
+  }
+}
+
+// ---- printing ----
+
+size_t Print::write(const char * str){
+  size_t n = 0;
+  while(*str){
+    n += write((uint8_t) *str++);
+  }
+  return n;
+}
+
+size_t Print::print(const char * str){
+  return write(str);
+}
+
+size_t Print::print(char c){
+  return write((uint8_t) c);
+}
+
+size_t Print::print_number(unsigned long n, int base){
+  char buf[8 * sizeof(long) + 1];
+  char * str = &buf[sizeof(buf) - 1];
+  *str = '\0';
+  if(base < 2){
+    base = 10;
+  }
+  do{
+    char digit = n % base;
+    n /= base;
+    *--str = (digit < 10) ? digit + '0' : digit + 'A' - 10;
+  }while(n);
+  return write(str);
+}
+
+size_t Print::print(unsigned char n, int base){
+  return print_number(n, base);
+}
+
+size_t Print::print(int n, int base){
+  return print((long) n, base);
+}
+
+size_t Print::print(unsigned int n, int base){
+  return print_number(n, base);
+}
+
+// unsigned long is 32 bits on the AVR, print negative numbers the same way
+size_t Print::print(long n, int base){
+  if(base == 10 && n < 0){
+    return print('-') + print_number((unsigned long) -n, 10);
+  }
+  return print_number((uint32_t) n, base);
+}
+
+size_t Print::print(unsigned long n, int base){
+  return print_number((uint32_t) n, base);
+}
+
+size_t Print::print(double n, int digits){
+  char buf[40];
+  snprintf(buf, sizeof(buf), "%.*f", digits, n);
+  return write(buf);
+}
+
+size_t Print::println(void){
+  return write("\r\n");
+}
+
+void HardwareSerial::begin(unsigned long baud){
+  this->baud = baud;
+}
+
+size_t HardwareSerial::write(uint8_t c){
+  fputc(c, host_serial_file ? host_serial_file : stdout);
+  if(baud == 0){
+    return 1;
+  }
+  // transmit from a 64 byte buffer, block while it is full
+  uint64_t char_us = 10000000ULL / baud;
+  if(serial_free_at < now_us){
+    serial_free_at = now_us;
+  }
+  serial_free_at += char_us;
+  if(serial_free_at > now_us + SERIAL_TX_BUFFER * char_us){
+    host_advance_us(serial_free_at - now_us - SERIAL_TX_BUFFER * char_us);
+  }
+  return 1;
+}
@@ -0,0 +1,59 @@
+/* Host side of the simulated Arduino in extras/host/Arduino.h.
+
+Tests and the motor simulator use these functions to look at the outputs
+the library drives, to feed its inputs and to move simulated time.  */
+
+#ifndef _WMS_HOST_HAL_H
+#define _WMS_HOST_HAL_H
+
+#include <stdio.h>
+#include "Arduino.h"
+
+/** Simulated time in microseconds since start. */
+uint64_t host_time_us(void);
+/** Let simulated time pass, running hooks and interrupts on the way. */
+void host_advance_us(uint32_t us);
+
+/** Last values latched into the two shift registers, as the library names
+ *  them: [0] first_shift_register, [1] second_shift_register. */
+extern uint8_t host_shift_register[2];
+/** Number of shift register latches so far. */
+extern uint32_t host_latch_count;
+
+/** Duty of the waveform on a pin, 0 (low) to 65535 (high), worked out
+ *  from the timer registers the way the hardware would drive the pin. */
+uint16_t host_pwm_duty(uint8_t pin);
+/** Carrier frequency in Hz of the timer output on a pin, 0 if the pin is
+ *  not currently driven by a timer. */
+uint32_t host_pwm_frequency(uint8_t pin);
+
+/** Non-zero while a simulated interrupt handler runs. */
+uint8_t host_in_interrupt(void);
+
+/** Pin change vectors, for tests that enter them with no pin changed. */
+extern "C" void PCINT0_vect(void);
+extern "C" void PCINT1_vect(void);
+extern "C" void PCINT2_vect(void);
+
+/** Drive an input pin from outside.  Raises pin change interrupts. */
+void host_set_pin(uint8_t pin, uint8_t level);
+/** Level of a pin as the board sees it. */
+uint8_t host_get_pin(uint8_t pin);
+/** Value analogRead() returns for an analog pin when no hook is set. */
+void host_set_analog(uint8_t pin, uint16_t counts);
+/** Pulse width pulseIn() reports for a pin, 0 for no pulses. */
+void host_set_pulse(uint8_t pin, uint32_t width_us);
+
+/** Where Serial output goes, standard output when 0. */
+extern FILE * host_serial_file;
+
+/** Called after every shift register latch. */
+extern void (*host_latch_hook)(void);
+/** Called when the duty of an output pin changes; see host_pwm_duty(). */
+extern void (*host_pwm_hook)(uint8_t pin, uint16_t duty);
+/** Supplies analogRead() results when set. */
+extern uint16_t (*host_analog_hook)(uint8_t pin);
+/** Called whenever simulated time has moved. */
+extern void (*host_time_hook)(uint64_t now_us);
+
+#endif /* _WMS_HOST_HAL_H */
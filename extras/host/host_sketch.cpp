@@ -0,0 +1,131 @@
+/* Run an Arduino sketch on the simulated Uno against extras/motor_sim.py.
+
+Build the sketch together with this file, host_hal.cpp and the library;
+motor_sim.py --sketch starts the program and answers on its standard
+input.  The program runs setup() and then loop() until the simulated time
+given as its argument, in seconds, has passed.
+
+Every line the program writes on standard output is an event, the
+simulated time in microseconds first:
+
+    <t> H                      start; the reply lists the encoder pins as
+                               "pin_a pin_b" pairs, or is empty
+    <t> S <first> <second>     shift register latch
+    <t> D <pin> <duty>         output duty change, 0..65535
+    <t> A <pin>                analogRead(); the reply is the count
+    <t> Q                      encoder poll; the reply has one count per
+                               encoder, which the program turns into edges
+                               on the encoder pins
+    <t> X                      end of the run
+
+Serial output goes to standard error.  */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "host_hal.h"
+
+#define LOOP_COST_US     (2)
+#define ENCODER_POLL_US  (50)
+#define MAX_ENCODERS     (6)
+
+void setup(void);
+void loop(void);
+
+static uint8_t encoder_count = 0;
+static uint8_t encoder_pins[MAX_ENCODERS][2];
+static long encoder_position[MAX_ENCODERS];
+static uint64_t last_poll = 0;
+
+static unsigned long long now(void){
+  return (unsigned long long) host_time_us();
+}
+
+static void read_reply(char * line, int size){
+  fflush(stdout);
+  if(fgets(line, size, stdin) == NULL){
+    exit(0); // simulator went away
+  }
+}
+
+static void on_latch(void){
+  printf("%llu S %u %u\n", now(), host_shift_register[0], host_shift_register[1]);
+}
+
+static void on_pwm(uint8_t pin, uint16_t duty){
+  // only the motor PWM pins of the standard and alternate pin maps
+  if(pin != 3 && pin != 4 && pin != 5 && pin != 6 && pin != 8 && pin != 9 && pin != 10 && pin != 11){
+    return;
+  }
+  printf("%llu D %u %u\n", now(), pin, duty);
+}
+
+static uint16_t on_analog(uint8_t pin){
+  char line[32];
+  printf("%llu A %u\n", now(), pin);
+  read_reply(line, sizeof(line));
+  return atoi(line);
+}
+
+// quadrature states for count & 3, (A << 1) | B, A leading B counts up
+static const uint8_t quadrature[4] = {0, 2, 3, 1};
+
+static void on_time(uint64_t now_us){
+  if(encoder_count == 0 || now_us - last_poll < ENCODER_POLL_US){
+    return;
+  }
+  if(!(SREG & 0x80) || host_in_interrupt()){
+    return; // edges would pile up unseen, poll once interrupts can run
+  }
+  last_poll = now_us;
+
+  char line[256];
+  printf("%llu Q\n", now());
+  read_reply(line, sizeof(line));
+  char * cursor = line;
+  for(uint8_t ii = 0; ii < encoder_count; ii++){
+    long target = strtol(cursor, &cursor, 10);
+    while(encoder_position[ii] != target){
+      encoder_position[ii] += (target > encoder_position[ii]) ? 1 : -1;
+      uint8_t state = quadrature[encoder_position[ii] & 3];
+      host_set_pin(encoder_pins[ii][0], state >> 1);
+      host_set_pin(encoder_pins[ii][1], state & 1);
+    }
+  }
+}
+
+int main(int argc, char ** argv){
+  double until = (argc > 1) ? atof(argv[1]) : 1.0;
+  char line[256];
+
+  host_serial_file = stderr;
+  printf("0 H\n");
+  read_reply(line, sizeof(line));
+  char * cursor = line;
+  char * end;
+  while(encoder_count < MAX_ENCODERS){
+    long pin_a = strtol(cursor, &end, 10);
+    if(end == cursor){
+      break;
+    }
+    long pin_b = strtol(end, &cursor, 10);
+    encoder_pins[encoder_count][0] = pin_a;
+    encoder_pins[encoder_count][1] = pin_b;
+    host_set_pin(pin_a, 0);
+    host_set_pin(pin_b, 0);
+    encoder_count++;
+  }
+
+  host_latch_hook = on_latch;
+  host_pwm_hook = on_pwm;
+  host_analog_hook = on_analog;
+  host_time_hook = on_time;
+
+  setup();
+  while(host_time_us() < until * 1e6){
+    loop();
+    host_advance_us(LOOP_COST_US);
+  }
+  printf("%llu X\n", now());
+  fflush(stdout);
+  return 0;
+}
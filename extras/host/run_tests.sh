@@ -0,0 +1,90 @@
+#!/bin/sh
+# Build the library for the host against the simulated Uno in extras/host
+# and run the host tests.
+#
+# Usage: extras/host/run_tests.sh
+#
+# Needs a host C++ compiler (CXX, default g++) and python3.  Unit tests are
+# programs in extras/host/tests.  Scenarios are sketches from
+# extras/host/scenarios run closed loop against extras/motor_sim.py.  Each
+# prints a PASS or FAIL line.  Exits with status 1 if any test fails.
+
+CXX=${CXX:-g++}
+HOST=$(cd "$(dirname "$0")" && pwd)
+EXTRAS=$(dirname "$HOST")
+REPO=$(dirname "$EXTRAS")
+BUILD=${BUILD_DIR:-${TMPDIR:-/tmp}/wms_host_tests}
+CXXFLAGS="-DARDUINO=10800 -std=gnu++11 -O1 -Wall -Wextra -I$HOST -I$REPO"
+
+mkdir -p "$BUILD"
+status=0
+
+# build a program with the host HAL and the library: build name sources...
+# "-x c++ -include Arduino.h sketch.ino" builds a sketch
+build() {
+  name=$1
+  shift
+  if ! $CXX $CXXFLAGS -o "$BUILD/$name" "$HOST/host_hal.cpp" \
+      "$REPO/WickedMotorShield.cpp" "$@"; then
+    echo "FAIL $name: build"
+    status=1
+    return 1
+  fi
+}
+
+# build and run a unit test: unit name "build flags"
+unit() {
+  build "$1" $2 "$HOST/tests/$1.cpp" || return
+  if ! "$BUILD/$1"; then
+    status=1
+  fi
+}
+
+# run a scenario sketch against the motor model:
+# scenario name "build flags" "motor_sim.py arguments"
+scenario() {
+  build "$1" $2 "$HOST/host_sketch.cpp" -x c++ -include Arduino.h "$HOST/scenarios/$1.ino" || return
+  # Serial output goes to standard error, the CSV samples are not needed
+  result=$(python3 "$EXTRAS/motor_sim.py" --sketch "$BUILD/$1" $3 2>&1 >/dev/null | grep "^[A-Z]* $1")
+  echo "${result:-FAIL $1: no result}"
+  case "$result" in
+    PASS*) ;;
+    *)     status=1 ;;
+  esac
+}
+
+# run a sketch that dumps a trace closed loop, replay the dump and compare
+# the run metrics: replay name "build flags" "motor_sim.py arguments"
+replay() {
+  build "$1" $2 "$HOST/host_sketch.cpp" -x c++ -include Arduino.h "$HOST/scenarios/$1.ino" || return
+  live=$(python3 "$EXTRAS/motor_sim.py" --sketch "$BUILD/$1" $3 --sweep dc_load=0 2>"$BUILD/$1.log")
+  replayed=$(python3 "$EXTRAS/motor_sim.py" "$BUILD/$1.log" $3 --sweep dc_load=0)
+  # each key=value within 1%, times within 2 ms of the first event offset
+  if echo "$live
+$replayed" | awk '
+      NR == 1 { for(ii = 2; ii <= NF; ii++){ split($ii, kv, "="); live[kv[1]] = kv[2] } }
+      NR == 2 { for(ii = 2; ii <= NF; ii++){
+                  split($ii, kv, "="); a = live[kv[1]]; b = kv[2]
+                  d = a - b; if(d < 0) d = -d
+                  m = (a < 0 ? -a : a); if(b > m) m = b; if(-b > m) m = -b
+                  if(!(kv[1] in live) || d > 0.01 * m + 0.002) bad = 1 } }
+      END { exit bad || NR != 2 }'; then
+    echo "PASS $1"
+  else
+    echo "FAIL $1: closed loop $live, replayed $replayed"
+    status=1
+  fi
+}
+
+unit test_encoder   "-DWMS_ENABLE_ENCODER=1"
+unit test_pwm_config ""
+unit test_trace      "-DWMS_TRACE_DEPTH=64"
+unit test_rc_mixer   "-DWMS_RCIN_CAPTURE=1"
+unit test_stepper    ""
+
+scenario stepper_home  ""                      "--stepper M1,M2 --set st_stop_lo=-120 --until 1"
+scenario current_sense ""                      "--dc M1 --set dc_load=1 --until 0.2"
+scenario encoder_move  "-DWMS_ENABLE_ENCODER=1" "--dc M1 --encoder M1=4,8 --until 5"
+replay   trace_replay  "-DWMS_TRACE_DEPTH=64"   "--dc M1 --until 0.5"
+
+exit $status
@@ -0,0 +1,34 @@
+// Oversampled currentSense() against the simulated DC motor, run by
+// run_tests.sh with the rotor locked: 12 V over 3 ohm gives 4 A, 800 counts
+// at the default sense gain, 3200 with two extra bits.
+#include <WickedMotorShield.h>
+
+Wicked_DCMotor motor(M1);
+
+void setup(){
+  Serial.begin(115200);
+
+  motor.setDirection(DIR_CW);
+  motor.setBrake(BRAKE_OFF);
+  motor.setOversampling(2);
+  motor.setSpeed(255);
+  delay(50); // let the winding current settle
+
+  uint16_t full = motor.currentSense();
+  motor.setSpeed(128);
+  delay(50);
+  uint16_t half = motor.currentSense();
+
+  if(full >= 3136 && full <= 3264 && half >= 1568 && half <= 1632){
+    Serial.print(F("PASS current_sense "));
+  }
+  else{
+    Serial.print(F("FAIL current_sense "));
+  }
+  Serial.print(full);
+  Serial.print(F(" "));
+  Serial.println(half);
+}
+
+void loop(void){
+}
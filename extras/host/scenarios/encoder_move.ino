@@ -0,0 +1,38 @@
+// moveTo() against the simulated DC motor and encoder, run by run_tests.sh
+// with the encoder on RCIN1 and RCIN2 and a build with WMS_ENABLE_ENCODER.
+#include <WickedMotorShield.h>
+
+Wicked_DCMotor motor(M1);
+
+// run a move to completion, false if it takes longer than timeout_ms
+static bool move(int32_t target, uint16_t timeout_ms){
+  uint32_t start = millis();
+  motor.moveTo(target, 200);
+  while(!motor.updatePosition()){
+    if(millis() - start > timeout_ms){
+      return false;
+    }
+  }
+  return true;
+}
+
+void setup(){
+  Serial.begin(115200);
+
+  uint8_t attached = motor.attachEncoder();
+  motor.setPositionGain(24);
+
+  bool ok = attached;
+  int32_t targets[] = {48, -100, 0};
+  for(uint8_t ii = 0; ii < 3 && ok; ii++){
+    ok = move(targets[ii], 2000);
+    delay(200); // moveTo() brakes at the target, the count must stay there
+    ok = ok && abs(motor.getPosition() - targets[ii]) <= 2;
+  }
+
+  Serial.print(ok ? F("PASS encoder_move ") : F("FAIL encoder_move "));
+  Serial.println(motor.getPosition());
+}
+
+void loop(void){
+}
@@ -0,0 +1,25 @@
+// home() against the simulated stepper, run by run_tests.sh with an end
+// stop 120 full steps counter clockwise of the start position.
+#include <WickedMotorShield.h>
+
+Wicked_Stepper stepper(200, M1, M2);
+
+void setup(){
+  Serial.begin(115200);
+
+  // fast enough for the back-EMF to lower the free-running coil current
+  stepper.setSpeed(240);
+  int32_t steps = stepper.home(-400);
+
+  // the stall shows within a few steps of reaching the stop
+  if(steps >= 120 && steps <= 130){
+    Serial.print(F("PASS stepper_home "));
+  }
+  else{
+    Serial.print(F("FAIL stepper_home "));
+  }
+  Serial.println(steps);
+}
+
+void loop(void){
+}
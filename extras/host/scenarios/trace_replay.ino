@@ -0,0 +1,29 @@
+// Records a DC motor run with the trace recorder and dumps it; run_tests.sh
+// replays the dump through extras/motor_sim.py and compares the result with
+// the closed loop run.  Needs a build with WMS_TRACE_DEPTH.
+#include <WickedMotorShield.h>
+
+Wicked_DCMotor motor(M1);
+
+void setup(){
+  Serial.begin(115200);
+  WickedMotorShield::clearTrace();
+
+  motor.setDirection(DIR_CW);
+  motor.setBrake(BRAKE_OFF);
+  for(int speed = 0; speed <= 250; speed += 50){
+    motor.setSpeed(speed);
+    delay(20);
+  }
+  motor.setBrake(BRAKE_SOFT);
+  delay(50);
+  motor.setDirection(DIR_CCW);
+  motor.setBrake(BRAKE_OFF);
+  delay(100);
+  motor.setBrake(BRAKE_HARD);
+
+  WickedMotorShield::dumpTrace(Serial);
+}
+
+void loop(void){
+}
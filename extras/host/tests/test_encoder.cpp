@@ -0,0 +1,159 @@
+/* Quadrature decoding and moveTo() on the simulated Uno.
+
+Built by run_tests.sh with WMS_ENABLE_ENCODER.  An edge generator drives
+the encoder pins, RCIN1 (PD4) and RCIN2 (PB0), directly:
+
+  * a random walk of single edges, checked count for count;
+  * the same walk with edges on other pins of both ports, glitches that
+    are gone before the interrupt runs and vector calls with nothing
+    changed, none of which may move the count;
+  * moveTo() to random targets with a simple motor on M1 turning the
+    encoder, which must settle within the tolerance.  */
+
+#include <stdio.h>
+#include "host_hal.h"
+#include <WickedMotorShield.h>
+
+#define PIN_A       (4)   // RCIN1_PIN in the standard pin map
+#define PIN_B       (8)   // RCIN2_PIN
+#define PWM_PIN     (11)  // M1
+#define NOISE_PD    (0)   // PD0, shares PCINT2 with PIN_A
+#define NOISE_PB    (13)  // PB5, shares PCINT0 with PIN_B
+
+static int failures = 0;
+
+#define CHECK(condition, ...) do{ \
+    if(!(condition)){ \
+      printf("FAIL test_encoder line %d: ", __LINE__); \
+      printf(__VA_ARGS__); \
+      printf("\n"); \
+      failures++; \
+    } \
+  } while(0)
+
+// quadrature states for count & 3, (A << 1) | B, A leading B counts up
+static const uint8_t quadrature[4] = {0, 2, 3, 1};
+static long generated = 0;
+
+static void set_encoder(long count){
+  uint8_t state = quadrature[count & 3];
+  host_set_pin(PIN_A, state >> 1);
+  host_set_pin(PIN_B, state & 1);
+}
+
+static void edge(int direction){
+  generated += direction;
+  set_encoder(generated);
+}
+
+static void random_walk(Wicked_DCMotor & motor, long edges, bool noise){
+  int direction = 1;
+  for(long ii = 0; ii < edges; ii++){
+    if(rand() % 8 == 0){
+      direction = -direction;
+    }
+    edge(direction);
+    if(noise){
+      switch(rand() % 4){
+      case 0:
+        host_set_pin(NOISE_PD, rand() & 1);
+        host_set_pin(NOISE_PB, rand() & 1);
+        break;
+      case 1:{
+        // a glitch on A that is gone before the interrupt runs
+        uint8_t level = host_get_pin(PIN_A);
+        cli();
+        host_set_pin(PIN_A, !level);
+        host_set_pin(PIN_A, level);
+        sei();
+        break;
+      }
+      case 2:
+        PCINT0_vect();
+        PCINT2_vect();
+        break;
+      }
+    }
+    host_advance_us(1 + rand() % 20);
+    if(ii % 97 == 0){
+      CHECK(motor.getPosition() == generated, "after %ld edges %ld, expected %ld",
+            ii, (long) motor.getPosition(), generated);
+    }
+  }
+  CHECK(motor.getPosition() == generated, "final %ld, expected %ld",
+        (long) motor.getPosition(), generated);
+}
+
+// M1 turning the encoder: speed follows the drive with a 20 ms lag,
+// 4000 counts/s at full duty, and a hard brake stops it within a few ms
+static double motor_position = 0.0;
+static double motor_speed = 0.0;
+static uint64_t motor_time = 0;
+
+static void run_motor(uint64_t now_us){
+  if(!(SREG & 0x80) || host_in_interrupt()){
+    return; // let edges wait for interrupts, as the encoder pins would
+  }
+  double dt = (now_us - motor_time) * 1e-6;
+  motor_time = now_us;
+
+  uint8_t bits = host_shift_register[0];
+  double drive = host_pwm_duty(PWM_PIN) / 65535.0 * 4000.0;
+  double tau = 0.020;
+  if(bits & M1_BRAKE_MASK){
+    drive = 0.0;
+    tau = (bits & M1_DIR_MASK) ? 0.002 : 0.200;
+  }
+  else if(!(bits & M1_DIR_MASK)){
+    drive = -drive;
+  }
+  motor_speed += (drive - motor_speed) * ((dt < tau) ? dt / tau : 1.0);
+  motor_position += motor_speed * dt;
+
+  long target = (long) motor_position;
+  while(generated != target){
+    edge((target > generated) ? 1 : -1);
+  }
+}
+
+static void move_to_targets(Wicked_DCMotor & motor){
+  host_time_hook = run_motor;
+  motor_time = host_time_us();
+  motor.setPositionGain(24);
+  for(int ii = 0; ii < 20; ii++){
+    int32_t target = generated + rand() % 2001 - 1000;
+    uint32_t start = millis();
+    motor.moveTo(target, 200);
+    while(!motor.updatePosition() && millis() - start < 3000){
+    }
+    CHECK(millis() - start < 3000, "move to %ld timed out at %ld", (long) target,
+          (long) motor.getPosition());
+    delay(100); // the brake must hold the motor on target
+    long error = motor.getPosition() - target;
+    CHECK(error >= -2 && error <= 2, "move to %ld ended at %ld", (long) target,
+          (long) motor.getPosition());
+  }
+  host_time_hook = 0;
+}
+
+int main(void){
+  srand(1);
+  set_encoder(0);
+
+  Wicked_DCMotor motor(M1);
+  CHECK(motor.attachEncoder(), "attachEncoder failed");
+  CHECK(motor.getPosition() == 0, "start at %ld", (long) motor.getPosition());
+
+  // other pins on the encoder ports with their pin change interrupts on
+  PCMSK2 |= _BV(digitalPinToPCMSKbit(NOISE_PD));
+  PCMSK0 |= _BV(digitalPinToPCMSKbit(NOISE_PB));
+
+  random_walk(motor, 20000, false);
+  random_walk(motor, 20000, true);
+  move_to_targets(motor);
+
+  if(failures == 0){
+    printf("PASS test_encoder\n");
+  }
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,189 @@
+/* setPWMFrequency(), setSpeed() and setSpeedFine() on the simulated Uno.
+
+Checks the prescaler and TOP chosen for each timer, the waveform mode and
+compare output bits written to TCCRnA/TCCRnB, the scaling of duty values
+into the compare registers, and the waveform the host HAL works out from
+those registers, and that an oversampled current reading still spans a
+whole carrier period below 16 Hz.  */
+
+#include <stdio.h>
+#include "host_hal.h"
+#include <WickedMotorShield.h>
+
+static int failures = 0;
+
+#define CHECK(condition, ...) do{ \
+    if(!(condition)){ \
+      printf("FAIL test_pwm_config line %d: ", __LINE__); \
+      printf(__VA_ARGS__); \
+      printf("\n"); \
+      failures++; \
+    } \
+  } while(0)
+
+#define CHECK_EQ(actual, expected) CHECK((actual) == (expected), \
+    "%s is %ld, expected %ld", #actual, (long) (actual), (long) (expected))
+
+// duty seen on a pin, within one part in a thousand
+#define CHECK_DUTY(pin, expected) CHECK(labs((long) host_pwm_duty(pin) - (long) (expected)) <= 65, \
+    "duty on pin %d is %u, expected %ld", pin, host_pwm_duty(pin), (long) (expected))
+
+static void timer1(void){
+  Wicked_DCMotor m2(M2);
+  Wicked_DCMotor m4(M4);
+
+  // 20 kHz: no prescaler, TOP = 16 MHz / (2 * 20 kHz)
+  CHECK_EQ(WickedMotorShield::setPWMFrequency(M2, 20000), PWM_CONFIG_OK);
+  CHECK_EQ(TCCR1A, _BV(COM1A1) | _BV(COM1B1) | _BV(WGM11));
+  CHECK_EQ(TCCR1B, _BV(WGM13) | _BV(CS10));
+  CHECK_EQ(ICR1, 400);
+  CHECK_EQ(OCR1A, 0);
+  CHECK_EQ(OCR1B, 0);
+  CHECK_EQ(WickedMotorShield::getPWMFrequency(M2), 20000);
+  CHECK_EQ(WickedMotorShield::getPWMFrequency(M4), 20000);
+  CHECK_EQ(WickedMotorShield::getPWMResolution(M4), 401);
+  CHECK_EQ(host_pwm_frequency(9), 20000);
+  CHECK_EQ(host_pwm_frequency(10), 20000);
+
+  // duty scaled to TOP, rounded
+  m2.setSpeedFine(32768);
+  CHECK_EQ(OCR1A, 200);
+  CHECK_DUTY(9, 32768);
+  m2.setSpeedFine(65535);
+  CHECK_EQ(OCR1A, 400);
+  CHECK_DUTY(9, 65535);
+  m4.setSpeed(64);
+  CHECK_EQ(OCR1B, 100);
+  CHECK_DUTY(10, 64 * 65535L / 255);
+  m4.setSpeed(0);
+  CHECK_EQ(OCR1B, 0);
+  CHECK_DUTY(10, 0);
+
+  // 1 kHz still fits TOP without a prescaler
+  CHECK_EQ(WickedMotorShield::setPWMFrequency(M4, 1000), PWM_CONFIG_OK);
+  CHECK_EQ(TCCR1B, _BV(WGM13) | _BV(CS10));
+  CHECK_EQ(ICR1, 8000);
+  CHECK_EQ(WickedMotorShield::getPWMResolution(M2), 8001);
+  m2.setSpeedFine(1);
+  CHECK_EQ(OCR1A, 0);
+  m2.setSpeedFine(9);
+  CHECK_EQ(OCR1A, 1);
+
+  // 50 Hz needs clk/8
+  CHECK_EQ(WickedMotorShield::setPWMFrequency(M2, 50), PWM_CONFIG_OK);
+  CHECK_EQ(TCCR1B, _BV(WGM13) | _BV(CS11));
+  CHECK_EQ(ICR1, 20000);
+  CHECK_EQ(host_pwm_frequency(9), 50);
+
+  // 1 Hz needs clk/256
+  CHECK_EQ(WickedMotorShield::setPWMFrequency(M2, 1), PWM_CONFIG_OK);
+  CHECK_EQ(TCCR1B, _BV(WGM13) | _BV(CS12));
+  CHECK_EQ(ICR1, 31250);
+  CHECK_EQ(WickedMotorShield::getPWMFrequency(M2), 1);
+
+  // TOP below 4 leaves too few duty steps, the timer is not touched
+  CHECK_EQ(WickedMotorShield::setPWMFrequency(M2, 2100000), PWM_CONFIG_INVALID);
+  CHECK_EQ(ICR1, 31250);
+  CHECK_EQ(WickedMotorShield::setPWMFrequency(M2, 0), PWM_CONFIG_INVALID);
+}
+
+static void timer2(void){
+  Wicked_DCMotor m1(M1);
+  Wicked_DCMotor m6(M6);
+
+  // the nearest phase correct prescaler frequency, 31372 Hz for clk/1
+  CHECK_EQ(WickedMotorShield::setPWMFrequency(M1, 20000), PWM_CONFIG_OK);
+  CHECK_EQ(TCCR2A, _BV(COM2A1) | _BV(COM2B1) | _BV(WGM20));
+  CHECK_EQ(TCCR2B, _BV(CS20));
+  CHECK_EQ(WickedMotorShield::getPWMFrequency(M6), 31372);
+  CHECK_EQ(WickedMotorShield::getPWMResolution(M1), 256);
+  CHECK_EQ(host_pwm_frequency(11), 31372);
+  CHECK_EQ(host_pwm_frequency(3), 31372);
+
+  m1.setSpeed(128);
+  CHECK_EQ(OCR2A, 128);
+  CHECK_DUTY(11, 128 * 65535L / 255);
+  m6.setSpeedFine(65535);
+  CHECK_EQ(OCR2B, 255);
+  CHECK_DUTY(3, 65535);
+
+  // clk/32 gives 980 Hz, only Timer2 has that prescaler
+  CHECK_EQ(WickedMotorShield::setPWMFrequency(M6, 1000), PWM_CONFIG_OK);
+  CHECK_EQ(TCCR2B, _BV(CS21) | _BV(CS20));
+  CHECK_EQ(OCR2A, 0);
+  CHECK_EQ(OCR2B, 0);
+  CHECK_EQ(host_pwm_frequency(11), 980);
+}
+
+static void timer0(void){
+  Wicked_DCMotor m3(M3);
+
+  // Timer0 runs millis(), left alone unless allowed
+  uint8_t tccr0a = TCCR0A;
+  uint8_t tccr0b = TCCR0B;
+  CHECK_EQ(WickedMotorShield::setPWMFrequency(M3, 4000), PWM_CONFIG_MILLIS_CONFLICT);
+  CHECK_EQ(TCCR0A, tccr0a);
+  CHECK_EQ(TCCR0B, tccr0b);
+  CHECK_EQ(WickedMotorShield::getPWMFrequency(M3), 0);
+
+  // clk/8 gives 3921 Hz
+  CHECK_EQ(WickedMotorShield::setPWMFrequency(M5, 4000, 1), PWM_CONFIG_OK);
+  CHECK_EQ(TCCR0A, _BV(COM0A1) | _BV(COM0B1) | _BV(WGM00));
+  CHECK_EQ(TCCR0B, _BV(CS01));
+  CHECK_EQ(host_pwm_frequency(5), 3921);
+  m3.setSpeed(200);
+  CHECK_EQ(OCR0B, 200);
+  CHECK_DUTY(5, 200 * 65535L / 255);
+}
+
+static void analog_write_default(void){
+  // a timer setPWMFrequency() never touched stays with analogWrite()
+  Wicked_DCMotor m1(M1);
+  CHECK_EQ(WickedMotorShield::getPWMFrequency(M1), 0);
+  CHECK_EQ(WickedMotorShield::getPWMResolution(M1), 256);
+  m1.setSpeed(100);
+  CHECK_EQ(OCR2A, 100);
+  CHECK_EQ(host_pwm_frequency(11), 490);
+  CHECK_DUTY(11, 100 * 65535L / 255); // Timer2 is phase correct on the Uno
+  m1.setSpeedFine(0x8000);
+  CHECK_EQ(OCR2A, 0x80);
+}
+
+static void slow_carrier_sense(void){
+  // 10 Hz: a 100 ms carrier period, which does not fit 16 bits
+  Wicked_DCMotor m2(M2);
+  CHECK_EQ(WickedMotorShield::setPWMFrequency(M2, 10), PWM_CONFIG_OK);
+  m2.setOversampling(1);
+  m2.setSpeed(128);
+
+  // 4 samples spread over one whole period, the last one 75 ms in
+  uint64_t start = host_time_us();
+  m2.currentSense();
+  uint64_t elapsed = host_time_us() - start;
+  CHECK(elapsed >= 75000 && elapsed < 76000, "oversampled read took %lu us", (unsigned long) elapsed);
+  CHECK_EQ(m2.getSampleRate(), 53);
+  m2.setOversampling(0);
+}
+
+static void alternate_pins(void){
+  // pins 8 and 4 have no PWM timer on the Uno
+  Wicked_DCMotor m1(M1, USE_ALTERNATE_PINS);
+  CHECK_EQ(WickedMotorShield::setPWMFrequency(M1, 20000), PWM_CONFIG_UNSUPPORTED);
+  CHECK_EQ(WickedMotorShield::setPWMFrequency(M6, 20000), PWM_CONFIG_UNSUPPORTED);
+  CHECK_EQ(WickedMotorShield::getPWMFrequency(M1), 0);
+  CHECK_EQ(WickedMotorShield::setPWMFrequency(M2, 20000), PWM_CONFIG_OK);
+}
+
+int main(void){
+  analog_write_default();
+  timer1();
+  timer2();
+  timer0();
+  slow_carrier_sense();
+  alternate_pins();
+
+  if(failures == 0){
+    printf("PASS test_pwm_config\n");
+  }
+  return failures ? 1 : 0;
+}
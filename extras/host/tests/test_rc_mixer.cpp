@@ -0,0 +1,223 @@
+/* Wicked_RCMixer with interrupt capture on the simulated Uno.
+
+Built by run_tests.sh with WMS_RCIN_CAPTURE.  RC frames are generated on
+RCIN1 (pin 4) and RCIN2 (pin 8) with host_set_pin(); the commands and the
+shield outputs are checked for:
+
+  * a pulse already high when capture starts, which must not be measured;
+  * the deadband edges, and the same magnitude on both sides of center;
+  * arcade mixing clamped to -255..255;
+  * expo;
+  * a motor attached reversed;
+  * the failsafe timeout;
+  * the time from the end of a frame to the new outputs, under 1 ms.  */
+
+#include <stdio.h>
+#include "host_hal.h"
+#include <WickedMotorShield.h>
+
+#define PIN_RC1     (4)   // RCIN1_PIN in the standard pin map
+#define PIN_RC2     (8)   // RCIN2_PIN
+#define PWM_LEFT    (11)  // M1
+#define PWM_RIGHT   (9)   // M2
+#define FRAME_US    (20000)
+
+static int failures = 0;
+
+#define CHECK(condition, ...) do{ \
+    if(!(condition)){ \
+      printf("FAIL test_rc_mixer line %d: ", __LINE__); \
+      printf(__VA_ARGS__); \
+      printf("\n"); \
+      failures++; \
+    } \
+  } while(0)
+
+#define CHECK_EQ(actual, expected) CHECK((actual) == (expected), \
+    "%s is %ld, expected %ld", #actual, (long) (actual), (long) (expected))
+
+static uint64_t frame_start = 0;
+static uint64_t frame_end = 0;
+
+// a pulse of exactly width us whatever the capture ISR took, returns the
+// time of its falling edge
+static uint64_t pulse(uint8_t pin, uint16_t width){
+  uint64_t rise = host_time_us();
+  host_set_pin(pin, 1);
+  host_advance_us(rise + width - host_time_us());
+  host_set_pin(pin, 0);
+  return rise + width;
+}
+
+// one receiver frame: RCIN1 pulse, then RCIN2 pulse; see pad_frame()
+static void frame(uint16_t width1, uint16_t width2){
+  frame_start = host_time_us();
+  pulse(PIN_RC1, width1);
+  frame_end = pulse(PIN_RC2, width2);
+}
+
+// wait out the rest of a FRAME_US frame
+static void pad_frame(void){
+  uint64_t elapsed = host_time_us() - frame_start;
+  if(elapsed < FRAME_US){
+    host_advance_us(FRAME_US - elapsed);
+  }
+}
+
+// a frame and the update() that applies it, -999 if none did
+static int16_t command(Wicked_RCMixer & mixer, uint8_t side, uint16_t width1, uint16_t width2){
+  frame(width1, width2);
+  uint8_t applied = mixer.update();
+  pad_frame();
+  return applied ? mixer.getCommand(side) : -999;
+}
+
+// signed drive of a motor as the shield outputs show it, -255..255
+static int drive(uint8_t pwm_pin, uint8_t dir_mask, uint8_t brake_mask){
+  if(host_shift_register[0] & brake_mask){
+    return 0;
+  }
+  int duty = (host_pwm_duty(pwm_pin) * 255L + 32767) / 65535;
+  return (host_shift_register[0] & dir_mask) ? duty : -duty;
+}
+
+static void start_high(Wicked_RCMixer & mixer){
+  // the receiver is mid pulse when capture starts
+  host_set_pin(PIN_RC1, 1);
+  host_set_pin(PIN_RC2, 1);
+  WickedMotorShield::begin();
+  host_advance_us(1000);
+  host_set_pin(PIN_RC1, 0);
+  host_set_pin(PIN_RC2, 0);
+  CHECK_EQ(WickedMotorShield::getRCINWidth(RCIN1), 0);
+  CHECK_EQ(WickedMotorShield::getRCINWidth(RCIN2), 0);
+  CHECK(!mixer.update(), "frame applied from unmeasured pulses");
+  host_advance_us(FRAME_US);
+
+  frame(1700, 1400);
+  CHECK_EQ(WickedMotorShield::getRCINWidth(RCIN1), 1700);
+  CHECK_EQ(WickedMotorShield::getRCINWidth(RCIN2), 1400);
+  CHECK(mixer.update(), "first whole frame not applied");
+  pad_frame();
+}
+
+static void deadband_and_symmetry(void){
+  Wicked_RCMixer mixer(MIX_TANK);
+  mixer.setCalibration(1500, 500, 20);
+
+  CHECK_EQ(command(mixer, MIX_LEFT, 1500, 1500), 0);
+  CHECK_EQ(command(mixer, MIX_LEFT, 1520, 1500), 0);
+  CHECK_EQ(command(mixer, MIX_LEFT, 1480, 1500), 0);
+  CHECK_EQ(command(mixer, MIX_LEFT, 1522, 1500), 1);
+  CHECK_EQ(command(mixer, MIX_LEFT, 1478, 1500), -1);
+  CHECK_EQ(command(mixer, MIX_LEFT, 2000, 1500), 255);
+  CHECK_EQ(command(mixer, MIX_LEFT, 1000, 1500), -255);
+  CHECK_EQ(command(mixer, MIX_LEFT, 2400, 1500), 255);
+  CHECK_EQ(command(mixer, MIX_LEFT, 600, 1500), -255);
+
+  for(uint16_t offset = 0; offset <= 520; offset += 4){
+    int16_t up = command(mixer, MIX_RIGHT, 1500, 1500 + offset);
+    int16_t down = command(mixer, MIX_RIGHT, 1500, 1500 - offset);
+    CHECK(up == -down, "+%u us gives %d, -%u us gives %d", offset, up, offset, down);
+  }
+
+  // out of range pulses are ignored
+  CHECK_EQ(command(mixer, MIX_LEFT, 450, 1500), -999);
+  CHECK_EQ(command(mixer, MIX_LEFT, 1500, 2600), -999);
+}
+
+static void arcade_and_expo(void){
+  Wicked_RCMixer mixer(MIX_ARCADE);
+
+  // throttle plus steering, clamped
+  CHECK_EQ(command(mixer, MIX_LEFT, 2000, 2000), 255);
+  CHECK_EQ(command(mixer, MIX_RIGHT, 2000, 2000), 0);
+  CHECK_EQ(command(mixer, MIX_LEFT, 1000, 2000), 0);
+  CHECK_EQ(command(mixer, MIX_RIGHT, 1000, 2000), -255);
+  CHECK_EQ(command(mixer, MIX_LEFT, 1760, 1760), 255);
+  CHECK_EQ(command(mixer, MIX_RIGHT, 1760, 1760), 0);
+
+  // half stick: 240 us past the deadband is 128 linear, 32 fully cubic
+  CHECK_EQ(command(mixer, MIX_LEFT, 1760, 1500), 128);
+  mixer.setExpo(255);
+  CHECK_EQ(command(mixer, MIX_LEFT, 1760, 1500), 32);
+  CHECK_EQ(command(mixer, MIX_LEFT, 1240, 1500), -32);
+  CHECK_EQ(command(mixer, MIX_LEFT, 2000, 1500), 255);
+  mixer.setExpo(128);
+  int16_t half = command(mixer, MIX_LEFT, 1760, 1500);
+  CHECK(half > 32 && half < 128, "half expo at half stick gives %d", half);
+}
+
+static uint64_t last_output = 0;
+
+static void on_output(void){
+  last_output = host_time_us();
+}
+
+static void on_pwm(uint8_t, uint16_t){
+  last_output = host_time_us();
+}
+
+static void outputs_and_failsafe(Wicked_RCMixer & mixer){
+  // M1 on the left, M2 on the right mounted mirror image
+  CHECK_EQ(command(mixer, MIX_LEFT, 2000, 1500), 255);
+  CHECK_EQ(drive(PWM_LEFT, M1_DIR_MASK, M1_BRAKE_MASK), 255);
+  CHECK_EQ(drive(PWM_RIGHT, M2_DIR_MASK, M2_BRAKE_MASK), -255);
+  command(mixer, MIX_LEFT, 1760, 1240);
+  CHECK_EQ(drive(PWM_LEFT, M1_DIR_MASK, M1_BRAKE_MASK), 0);
+  CHECK_EQ(drive(PWM_RIGHT, M2_DIR_MASK, M2_BRAKE_MASK), -255);
+
+  // time from the end of the frame to the last output change
+  host_latch_hook = on_output;
+  host_pwm_hook = on_pwm;
+  for(uint16_t width = 1100; width <= 1900; width += 100){
+    frame(width, 1500);
+    while(!mixer.update()){
+    }
+    uint64_t latency = last_output - frame_end;
+    CHECK(last_output >= frame_end && latency < 1000, "outputs %ld us after the frame",
+          (long) latency);
+    pad_frame();
+  }
+  host_latch_hook = 0;
+  host_pwm_hook = 0;
+
+  // failsafe: nothing for just under the timeout, then the brake
+  frame(1800, 1500);
+  mixer.update();
+  uint32_t last = millis();
+  while(millis() - last < 95){
+    mixer.update();
+  }
+  CHECK(!(host_shift_register[0] & M1_BRAKE_MASK), "failsafe before the timeout");
+  while(millis() - last < 105){
+    mixer.update();
+  }
+  CHECK(host_shift_register[0] & M1_BRAKE_MASK, "no failsafe brake on M1");
+  CHECK(host_shift_register[0] & M2_BRAKE_MASK, "no failsafe brake on M2");
+  CHECK(!(host_shift_register[0] & M1_DIR_MASK), "M1 braked hard, not soft");
+  CHECK_EQ(host_pwm_duty(PWM_LEFT), 0);
+  CHECK_EQ(mixer.getCommand(MIX_LEFT), 0);
+
+  // the next good frame drives again
+  CHECK_EQ(command(mixer, MIX_LEFT, 1800, 1500), 149);
+  CHECK(!(host_shift_register[0] & M1_BRAKE_MASK), "brake left on after recovery");
+}
+
+int main(void){
+  Wicked_DCMotor left(M1);
+  Wicked_DCMotor right(M2);
+  Wicked_RCMixer mixer(MIX_ARCADE);
+  mixer.attach(left, MIX_LEFT);
+  mixer.attach(right, MIX_RIGHT, 1);
+
+  start_high(mixer);
+  deadband_and_symmetry();
+  arcade_and_expo();
+  outputs_and_failsafe(mixer);
+
+  if(failures == 0){
+    printf("PASS test_rc_mixer\n");
+  }
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,116 @@
+/* Wicked_Stepper drive sequences on the simulated Uno.
+
+Steps a stepper on M1 and M2 through every drive mode, switching mode
+after every number of steps, and reads the latched coil states back as a
+position in the half step sequence.  A step must move one half step in
+half drive and two otherwise; a mode switch must latch the new image at
+once and may move the rotor by at most half a step.  */
+
+#include <stdio.h>
+#include "host_hal.h"
+#include <WickedMotorShield.h>
+
+static int failures = 0;
+
+#define CHECK(condition, ...) do{ \
+    if(!(condition)){ \
+      printf("FAIL test_stepper line %d: ", __LINE__); \
+      printf(__VA_ARGS__); \
+      printf("\n"); \
+      failures++; \
+    } \
+  } while(0)
+
+static const char * const mode_names[3] = {"full", "half", "wave"};
+
+// coil states of half steps 0..7, as the library orders them
+static const int8_t half_steps[8][2] = {{1,-1}, {0,-1}, {-1,-1}, {-1,0}, {-1,1}, {0,1}, {1,1}, {1,0}};
+
+static int8_t coil(uint8_t dir_mask, uint8_t brake_mask){
+  if(host_shift_register[0] & brake_mask){
+    return 0;
+  }
+  return (host_shift_register[0] & dir_mask) ? 1 : -1;
+}
+
+// latched rotor position in half steps, -1 if the coils match none
+static int position(void){
+  int8_t a = coil(M1_DIR_MASK, M1_BRAKE_MASK);
+  int8_t b = coil(M2_DIR_MASK, M2_BRAKE_MASK);
+  for(int ii = 0; ii < 8; ii++){
+    if(half_steps[ii][0] == a && half_steps[ii][1] == b){
+      return ii;
+    }
+  }
+  return -1;
+}
+
+// signed distance from one half step position to another, -4..3
+static int moved(int from, int to){
+  return ((to - from + 12) % 8) - 4;
+}
+
+static void switch_modes(void){
+  Wicked_Stepper stepper(200, M1, M2);
+  stepper.step(1); // powers and latches the coils
+
+  for(uint8_t from = 0; from < 3; from++){
+    for(uint8_t to = 0; to < 3; to++){
+      for(int steps = -4; steps <= 4; steps++){
+        stepper.setDriveMode(from);
+        int before = position();
+        for(int ii = 0; ii < (steps < 0 ? -steps : steps); ii++){
+          stepper.step(steps < 0 ? -1 : 1);
+          int after = position();
+          int expected = (from == STEP_HALF) ? 1 : 2;
+          CHECK(moved(before, after) == (steps < 0 ? -expected : expected),
+                "%s step %+d went from half step %d to %d", mode_names[from],
+                steps < 0 ? -1 : 1, before, after);
+          before = after;
+        }
+
+        uint32_t latches = host_latch_count;
+        stepper.setDriveMode(to);
+        int after = position();
+        CHECK(host_latch_count == latches + 1, "%s to %s latched %lu times", mode_names[from],
+              mode_names[to], (unsigned long) (host_latch_count - latches));
+        int shift = moved(before, after);
+        CHECK(after >= 0 && shift >= -1 && shift <= 1 && (from != to || shift == 0),
+              "%s to %s moved from half step %d to %d", mode_names[from], mode_names[to],
+              before, after);
+
+        // the next step goes on from the latched position
+        stepper.step(1);
+        int expected = (to == STEP_HALF) ? 1 : 2;
+        CHECK(moved(after, position()) == expected, "first %s step after %s went from %d to %d",
+              mode_names[to], mode_names[from], after, position());
+      }
+    }
+  }
+}
+
+static void released_coils(void){
+  // a released motor is not energized by a mode switch
+  Wicked_Stepper stepper(200, M1, M2);
+  stepper.setIdleTimeout(10, BRAKE_SOFT);
+  stepper.step(3);
+  delay(20);
+  stepper.update();
+  uint8_t released = host_shift_register[0];
+  stepper.setDriveMode(STEP_HALF);
+  CHECK(host_shift_register[0] == released, "released coils latched as %02x, were %02x",
+        host_shift_register[0], released);
+  stepper.step(1);
+  CHECK(position() >= 0, "no coil image after leaving the hold brake");
+}
+
+int main(void){
+  WickedMotorShield::begin();
+  switch_modes();
+  released_coils();
+
+  if(failures == 0){
+    printf("PASS test_stepper\n");
+  }
+  return failures ? 1 : 0;
+}
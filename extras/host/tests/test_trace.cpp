@@ -0,0 +1,214 @@
+/* The trace recorder on the simulated Uno.
+
+Built by run_tests.sh with WMS_TRACE_DEPTH=64.  Drives a few motors, logs
+every shift register latch and PWM change the host HAL sees, then parses
+dumpTrace() and checks it event for event against that log: same data,
+and time stamps that convert back to the HAL's time within a few
+microseconds.  A second part overflows the ring and checks that the
+oldest events were dropped.  The last part moves Timer0 to phase correct
+PWM at clk/8 and checks that the trace then keeps time with micros().  */
+
+#include <stdio.h>
+#include "host_hal.h"
+#include <WickedMotorShield.h>
+
+static int failures = 0;
+
+#define CHECK(condition, ...) do{ \
+    if(!(condition)){ \
+      printf("FAIL test_trace line %d: ", __LINE__); \
+      printf(__VA_ARGS__); \
+      printf("\n"); \
+      failures++; \
+    } \
+  } while(0)
+
+#define MAX_EVENTS (256)
+
+struct Event{
+  uint64_t time;  // microseconds as seen, trace ticks as dumped
+  char type;
+  uint8_t data[2];
+};
+
+static Event observed[MAX_EVENTS];
+static uint16_t observed_count = 0;
+
+static void record(char type, uint8_t data0, uint8_t data1){
+  if(observed_count < MAX_EVENTS){
+    Event * event = &observed[observed_count++];
+    event->time = host_time_us();
+    event->type = type;
+    event->data[0] = data0;
+    event->data[1] = data1;
+  }
+}
+
+static void on_latch(void){
+  record(TRACE_SHIFT_REGISTER, host_shift_register[0], host_shift_register[1]);
+}
+
+static void on_pwm(uint8_t pin, uint16_t duty){
+  static const uint8_t pins[6] = {11, 9, 5, 10, 6, 3};
+  for(uint8_t motor = 0; motor < 6; motor++){
+    if(pins[motor] == pin){
+      record(TRACE_PWM, motor, (duty + 128) / 257);
+    }
+  }
+}
+
+// collects dumpTrace() output
+class Capture : public Print{
+ public:
+  Capture(void) : length(0) { text[0] = 0; }
+  virtual size_t write(uint8_t c){
+    if(length + 1 < sizeof(text)){
+      text[length++] = c;
+      text[length] = 0;
+    }
+    return 1;
+  }
+  char text[8192];
+  size_t length;
+};
+
+// parse a dump, return the number of events or -1 for a bad header
+static int parse_dump(const char * text, Event * events, unsigned long * tick_ns){
+  int version = 0;
+  if(sscanf(text, "# wms-trace %d %lu", &version, tick_ns) != 2 || version != 2){
+    return -1;
+  }
+  int count = 0;
+  const char * line = strchr(text, '\n');
+  while(line != NULL && count < MAX_EVENTS){
+    line++;
+    unsigned long time;
+    char type;
+    unsigned int data0, data1;
+    if(sscanf(line, "%lx %c %x %x", &time, &type, &data0, &data1) == 4){
+      events[count].time = time;
+      events[count].type = type;
+      events[count].data[0] = data0;
+      events[count].data[1] = data1;
+      count++;
+    }
+    line = strchr(line, '\n');
+  }
+  return count;
+}
+
+static void drive(void){
+  Wicked_DCMotor m1(M1);
+  Wicked_DCMotor m3(M3);
+  Wicked_Stepper stepper(200, M5, M6);
+
+  m1.setDirection(DIR_CW);
+  m1.setBrake(BRAKE_OFF);
+  m1.setSpeed(200);
+  delay(3);
+  m3.setDirection(DIR_CCW);
+  m3.setBrake(BRAKE_OFF);
+  m3.setSpeed(17);
+  delay(5);
+  stepper.setSpeed(600);
+  stepper.step(8);
+  m1.setBrake(BRAKE_HARD);
+  m3.setSpeed(0);
+}
+
+static void match_dump(unsigned long expected_tick_ns){
+  static Event dumped[MAX_EVENTS];
+  Capture capture;
+  WickedMotorShield::dumpTrace(capture);
+  unsigned long tick_ns = 0;
+  int count = parse_dump(capture.text, dumped, &tick_ns);
+
+  CHECK(count >= 0, "bad dump header: %.40s", capture.text);
+  CHECK(tick_ns == expected_tick_ns, "tick of %lu ns, expected %lu", tick_ns, expected_tick_ns);
+  CHECK(count == observed_count, "%d events dumped, %u seen", count, observed_count);
+  CHECK(strstr(capture.text, "# end") != NULL, "no end line");
+  if(count != observed_count || tick_ns == 0){
+    return;
+  }
+
+  // the first event fixes the offset between the two clocks
+  int64_t offset = (int64_t) observed[0].time - (int64_t) (dumped[0].time * tick_ns / 1000);
+  for(int ii = 0; ii < count; ii++){
+    Event * seen = &observed[ii];
+    Event * traced = &dumped[ii];
+    // fast PWM on Timer0 puts the pin one count above the traced duty
+    int duty_error = (int) traced->data[1] - (int) seen->data[1];
+    CHECK(traced->type == seen->type && traced->data[0] == seen->data[0] &&
+          (traced->type == TRACE_PWM ? (duty_error >= -1 && duty_error <= 1) : duty_error == 0),
+          "event %d traced as %c %02x %02x, seen %c %02x %02x", ii,
+          traced->type, traced->data[0], traced->data[1],
+          seen->type, seen->data[0], seen->data[1]);
+    int64_t error = (int64_t) (traced->time * tick_ns / 1000) + offset - (int64_t) seen->time;
+    CHECK(error >= -16 && error <= 16, "event %d traced %ld us from the HAL time", ii, (long) error);
+  }
+}
+
+static void wrap(void){
+  Wicked_DCMotor m2(M2);
+  WickedMotorShield::clearTrace();
+  for(int ii = 0; ii < 100; ii++){
+    m2.setSpeed(ii);
+  }
+
+  static Event dumped[MAX_EVENTS];
+  Capture capture;
+  WickedMotorShield::dumpTrace(capture);
+  unsigned long tick_ns = 0;
+  int count = parse_dump(capture.text, dumped, &tick_ns);
+  CHECK(count == WMS_TRACE_DEPTH, "%d events after wrapping", count);
+  for(int ii = 0; ii < count; ii++){
+    CHECK(dumped[ii].type == TRACE_PWM && dumped[ii].data[1] == 100 - WMS_TRACE_DEPTH + ii,
+          "event %d after wrapping is %c %02x %02x", ii, dumped[ii].type,
+          dumped[ii].data[0], dumped[ii].data[1]);
+    if(ii > 0){
+      CHECK(dumped[ii].time >= dumped[ii - 1].time, "event %d goes back in time", ii);
+    }
+  }
+}
+
+static void timer0_reconfigured(void){
+  // Timer0 no longer counts at clk/64, the recorder changes clock
+  CHECK(WickedMotorShield::setPWMFrequency(M3, 4000, 1) == PWM_CONFIG_OK, "Timer0 not configured");
+  static Event dumped[MAX_EVENTS];
+  Capture capture;
+  WickedMotorShield::dumpTrace(capture);
+  unsigned long tick_ns = 0;
+  int count = parse_dump(capture.text, dumped, &tick_ns);
+  CHECK(count == 0 && tick_ns == 1000, "%d events with %lu ns ticks kept", count, tick_ns);
+
+  // Timer2 events spread over a few Timer0 periods
+  Wicked_DCMotor m1(M1);
+  observed_count = 0;
+  host_pwm_hook = on_pwm;
+  for(int ii = 1; ii <= 20; ii++){
+    m1.setSpeed(ii * 10);
+    delayMicroseconds(ii * 97);
+  }
+  host_pwm_hook = 0;
+  match_dump(1000);
+}
+
+int main(void){
+  WickedMotorShield::begin();
+  WickedMotorShield::clearTrace();
+  host_latch_hook = on_latch;
+  host_pwm_hook = on_pwm;
+
+  drive();
+  host_latch_hook = 0;
+  host_pwm_hook = 0;
+  CHECK(observed_count > 10 && observed_count < WMS_TRACE_DEPTH, "%u events seen", observed_count);
+  match_dump(4000); // a count of Timer0 at clk/64 and 16 MHz
+  wrap();
+  timer0_reconfigured();
+
+  if(failures == 0){
+    printf("PASS test_trace\n");
+  }
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,489 @@
+#!/usr/bin/env python3
+"""Simulate the motors attached to a Wicked Motor Shield on the host.
+
+The simulator consumes the shield outputs: the bridge state of every
+channel, taken from the Mx_DIR_MASK / Mx_BRAKE_MASK bits of both shift
+registers, and the PWM duty of every channel.  It integrates an electrical
+and mechanical model for each attached motor and returns the modeled
+current as the counts analogRead() gives on the channel's current sense
+input.
+
+The outputs come from one of two sources:
+
+  * a trace dump recorded on a board (see trace_decode.py), replayed
+    open loop;
+  * a sketch built for the host with extras/host (see run_tests.sh), run
+    closed loop: the library's shift register loads and PWM registers
+    drive the model, and its analogRead() calls and encoder pins are fed
+    from the model, so stall detection, current sensing and position
+    control run against it.  The protocol is described in
+    extras/host/host_sketch.cpp.
+
+Bridge states are modeled as:
+    CW / CCW     supply voltage times duty, positive or negative
+    BRAKE_HARD   motor terminals shorted; back-EMF drives a braking current
+    BRAKE_SOFT   bridge off; winding current decays through the body
+                 diodes into the supply, then the motor coasts
+
+PWM is modeled by its average voltage, which lets the integration step be
+much longer than the carrier period so runs are many times faster than
+real time.
+
+Usage:
+    motor_sim.py [options] logfile
+    motor_sim.py [options] --sketch PROGRAM
+
+    --dc M1            attach a DC motor to a channel (repeatable)
+    --encoder M1=4,8   give the DC motor on a channel a quadrature encoder
+                       on two pins, dc_cpr counts per revolution
+    --stepper M1,M2    attach a two-coil stepper to two channels (repeatable)
+    --set NAME=VALUE   override a model parameter (repeatable)
+    --sweep NAME=V1,V2,...
+                       rerun the simulation for each value and print one
+                       line of metrics per run
+    --until SECONDS    simulated time to run after the last trace event,
+                       or in total for a sketch
+    --every SECONDS    output period for the CSV samples
+
+Other scripts can import ShieldSim to drive the model directly.
+"""
+
+import argparse
+import math
+import subprocess
+import sys
+
+import trace_decode
+
+MOTORS = trace_decode.MOTORS
+
+# current sense input for each channel, as in WickedMotorShield::currentSenseM()
+SENSE_PINS = ("A0", "A2", "A1", "A3", "A4", "A5")
+
+# PWM pin of each channel in the standard and the alternate pin map
+PWM_PINS = {11: 0, 8: 0, 9: 1, 5: 2, 10: 3, 6: 4, 3: 5, 4: 5}
+
+DEFAULTS = {
+    "supply_v": 12.0,          # motor supply voltage
+    "sense_counts_per_a": 200.0,  # analogRead() counts per amp of winding current
+    # DC motor
+    "dc_r": 3.0,               # winding resistance, ohm
+    "dc_l": 0.002,             # winding inductance, henry
+    "dc_k": 0.02,              # torque / back-EMF constant, N*m/A = V*s/rad
+    "dc_j": 2e-6,              # rotor inertia, kg*m^2
+    "dc_b": 1e-5,              # viscous friction, N*m*s/rad
+    "dc_load": 0.0,            # Coulomb load torque, N*m
+    "dc_cpr": 48.0,            # encoder counts per revolution, four per line
+    # stepper
+    "st_r": 4.0,               # coil resistance, ohm
+    "st_l": 0.005,             # coil inductance, henry
+    "st_k": 0.3,               # torque constant per coil, N*m/A
+    "st_j": 5e-6,              # rotor inertia, kg*m^2
+    "st_b": 2e-4,              # viscous friction, N*m*s/rad
+    "st_poles": 50,            # rotor teeth, 50 for a 200 step/rev motor
+    "st_load": 0.0,            # Coulomb load torque, N*m
+    "st_stop_lo": -math.inf,   # mechanical end stops, in full steps from
+    "st_stop_hi": math.inf,    # the start position
+}
+
+
+def winding_voltage(state, duty, current, emf, supply):
+    """Return (volts, diode) for a winding driven by a bridge in a state.
+
+    duty is 0..1.  volts is None for an open circuit.  diode is True when
+    the voltage comes from the body diodes, so the current can fall to zero
+    but not reverse.
+    """
+    if state == "CW":
+        return supply * duty, False
+    if state == "CCW":
+        return -supply * duty, False
+    if state == "BRAKE_HARD":
+        return 0.0, False
+    # BRAKE_SOFT: only the body diodes conduct, opposing the current or
+    # clamping a back-EMF above the supply
+    if current > 0.0 or (current == 0.0 and emf > supply):
+        return -supply, True
+    if current < 0.0 or (current == 0.0 and emf < -supply):
+        return supply, True
+    return None, True
+
+
+def step_current(current, volts, diode, emf, r, l, dt):
+    """Advance a winding current by one integration step."""
+    if volts is None:
+        return 0.0
+    new = current + (volts - r * current - emf) * dt / l
+    if diode and new * current < 0.0:
+        return 0.0
+    return new
+
+
+def step_speed(omega, torque, load, j, dt):
+    """Advance a rotor speed by one step under a Coulomb load torque.
+
+    The full load opposes the motion while the rotor turns.  At standstill
+    it holds the rotor until the driving torque exceeds it.  A load never
+    reverses the rotor: a step that would cross zero stops it instead.
+    """
+    if omega != 0.0:
+        new = omega + (torque - math.copysign(load, omega)) * dt / j
+        if new * omega < 0.0:
+            return 0.0
+        return new
+    if abs(torque) <= load:
+        return 0.0
+    return (torque - math.copysign(load, torque)) * dt / j
+
+
+class DCMotorModel(object):
+    """Brushed DC motor on one channel, optionally with a quadrature encoder."""
+
+    def __init__(self, channel, p):
+        self.channel = channel
+        self.p = p
+        self.current = 0.0
+        self.omega = 0.0
+        self.theta = 0.0
+        self.encoder_pins = None
+        self.peak_current = 0.0
+        self.peak_omega = 0.0
+
+    def name(self):
+        return MOTORS[self.channel]
+
+    def step(self, sim, dt):
+        p = self.p
+        emf = p["dc_k"] * self.omega
+        volts, diode = winding_voltage(sim.bridge[self.channel], sim.duty[self.channel],
+                                       self.current, emf, p["supply_v"])
+        self.current = step_current(self.current, volts, diode, emf, p["dc_r"], p["dc_l"], dt)
+        torque = p["dc_k"] * self.current - p["dc_b"] * self.omega
+        self.omega = step_speed(self.omega, torque, p["dc_load"], p["dc_j"], dt)
+        self.theta += self.omega * dt
+        sim.sense[self.channel] = abs(self.current)
+        self.peak_current = max(self.peak_current, abs(self.current))
+        self.peak_omega = max(self.peak_omega, abs(self.omega))
+
+    def encoder_count(self):
+        return int(math.floor(self.theta / (2.0 * math.pi) * self.p["dc_cpr"]))
+
+    def row(self):
+        row = {self.name() + "_rpm": self.omega * 60.0 / (2.0 * math.pi)}
+        if self.encoder_pins:
+            row[self.name() + "_counts"] = self.encoder_count()
+        return row
+
+    def metrics(self):
+        metrics = {self.name() + "_peak_a": self.peak_current,
+                   self.name() + "_peak_rpm": self.peak_omega * 60.0 / (2.0 * math.pi)}
+        if self.encoder_pins:
+            metrics[self.name() + "_final_counts"] = self.encoder_count()
+        return metrics
+
+
+class StepperModel(object):
+    """Two-coil hybrid stepper with coil A on one channel and coil B on another."""
+
+    def __init__(self, channel_a, channel_b, p):
+        self.channels = (channel_a, channel_b)
+        self.p = p
+        self.currents = [0.0, 0.0]
+        self.omega = 0.0
+        self.theta = 0.0
+        self.peak_current = 0.0
+        self.peak_omega = 0.0
+
+    def name(self):
+        return MOTORS[self.channels[0]] + MOTORS[self.channels[1]]
+
+    def full_steps(self):
+        return self.theta * self.p["st_poles"] * 2.0 / math.pi
+
+    def step(self, sim, dt):
+        p = self.p
+        angle = p["st_poles"] * self.theta
+        # back-EMF and torque shape of each coil
+        shapes = (math.sin(angle), math.cos(angle))
+        torque = -p["st_b"] * self.omega
+        for coil in range(2):
+            channel = self.channels[coil]
+            emf = p["st_k"] * self.omega * shapes[coil]
+            volts, diode = winding_voltage(sim.bridge[channel], sim.duty[channel],
+                                           self.currents[coil], emf, p["supply_v"])
+            self.currents[coil] = step_current(self.currents[coil], volts, diode, emf,
+                                               p["st_r"], p["st_l"], dt)
+            torque += p["st_k"] * self.currents[coil] * shapes[coil]
+            sim.sense[channel] = abs(self.currents[coil])
+            self.peak_current = max(self.peak_current, abs(self.currents[coil]))
+        self.omega = step_speed(self.omega, torque, p["st_load"], p["st_j"], dt)
+        self.theta += self.omega * dt
+        # a mechanical stop absorbs the rotor's motion
+        steps = self.full_steps()
+        for limit, outside in ((p["st_stop_lo"], steps < p["st_stop_lo"]),
+                               (p["st_stop_hi"], steps > p["st_stop_hi"])):
+            if outside:
+                self.theta = limit * math.pi / (2.0 * p["st_poles"])
+                self.omega = 0.0
+        self.peak_omega = max(self.peak_omega, abs(self.omega))
+
+    def row(self):
+        return {self.name() + "_rpm": self.omega * 60.0 / (2.0 * math.pi),
+                self.name() + "_steps": self.full_steps()}
+
+    def metrics(self):
+        return {self.name() + "_peak_a": self.peak_current,
+                self.name() + "_peak_rpm": self.peak_omega * 60.0 / (2.0 * math.pi),
+                self.name() + "_final_steps": self.full_steps()}
+
+
+class ShieldSim(object):
+    """Shield outputs, attached motor models and simulated analogRead()."""
+
+    def __init__(self, params=None, dt=50e-6, every=0.001):
+        self.p = dict(DEFAULTS)
+        if params:
+            self.p.update(params)
+        self.dt = dt
+        self.every = every
+        self.bridge = ["BRAKE_HARD"] * len(MOTORS)  # power-on register state
+        self.duty = [0.0] * len(MOTORS)
+        self.sense = [0.0] * len(MOTORS)
+        self.models = []
+        self.steps = 0
+        self.rows = []
+        self.next_sample = 0.0
+
+    @property
+    def time(self):
+        return self.steps * self.dt
+
+    def attach_dc(self, channel):
+        model = DCMotorModel(channel, self.p)
+        self.models.append(model)
+        return model
+
+    def attach_encoder(self, channel, pin_a, pin_b):
+        for model in self.models:
+            if isinstance(model, DCMotorModel) and model.channel == channel:
+                model.encoder_pins = (pin_a, pin_b)
+                return
+        raise ValueError("no DC motor on %s for the encoder" % MOTORS[channel])
+
+    def attach_stepper(self, channel_a, channel_b):
+        model = StepperModel(channel_a, channel_b, self.p)
+        self.models.append(model)
+        return model
+
+    def encoders(self):
+        return [model for model in self.models
+                if isinstance(model, DCMotorModel) and model.encoder_pins]
+
+    def apply(self, motor, field, value):
+        """Apply one change from trace_decode.decode().
+
+        field "pwm" takes a duty of 0..255, field "duty" a fraction.
+        """
+        if field == "bridge":
+            self.bridge[motor] = value
+        elif field == "pwm":
+            self.duty[motor] = value / 255.0
+        elif field == "duty":
+            self.duty[motor] = value
+
+    def apply_registers(self, first, second):
+        """Apply a shift register load."""
+        for motor in range(len(MOTORS)):
+            self.bridge[motor] = trace_decode.bridge_state((first, second), motor)
+
+    def analog_read(self, pin):
+        """Return the counts analogRead() would give on A0..A5."""
+        if isinstance(pin, int):
+            pin = "A%d" % (pin - 14 if pin >= 14 else pin)
+        if pin not in SENSE_PINS:
+            return 0
+        channel = SENSE_PINS.index(pin)
+        counts = int(self.sense[channel] * self.p["sense_counts_per_a"])
+        return max(0, min(1023, counts))
+
+    def advance_to(self, target):
+        """Integrate up to target seconds, sampling a row every self.every.
+
+        The model stays less than one step behind target; the remainder is
+        carried into the next call.
+        """
+        epsilon = self.dt * 1e-6
+        while True:
+            if self.time >= self.next_sample - epsilon:
+                self.rows.append(self.row())
+                self.next_sample += self.every
+            if self.time + self.dt > target + epsilon:
+                return
+            for model in self.models:
+                model.step(self, self.dt)
+            self.steps += 1
+
+    def row(self):
+        row = {"time_s": self.time}
+        for model in self.models:
+            row.update(model.row())
+        for channel in range(len(MOTORS)):
+            row[SENSE_PINS[channel]] = self.analog_read(SENSE_PINS[channel])
+        return row
+
+    def run(self, changes, until=0.0):
+        """Replay decoded changes, then run for until seconds; return the rows."""
+        for time_us, motor, field, value in changes:
+            self.advance_to(time_us / 1e6)
+            self.apply(motor, field, value)
+        self.advance_to((changes[-1][0] / 1e6 if changes else 0.0) + until)
+        return self.rows
+
+    def run_sketch(self, program, until):
+        """Run a host-built sketch against the models for until seconds.
+
+        The sketch's standard error, its Serial output, is passed through.
+        Returns the rows.
+        """
+        proc = subprocess.Popen([program, repr(until)], stdin=subprocess.PIPE,
+                                stdout=subprocess.PIPE, universal_newlines=True)
+
+        def reply(text):
+            proc.stdin.write(text + "\n")
+            proc.stdin.flush()
+
+        try:
+            while True:
+                line = proc.stdout.readline()
+                if not line:
+                    raise RuntimeError("%s stopped without finishing" % program)
+                fields = line.split()
+                self.advance_to(int(fields[0]) / 1e6)
+                kind = fields[1]
+                if kind == "S":
+                    self.apply_registers(int(fields[2]), int(fields[3]))
+                elif kind == "D":
+                    pin = int(fields[2])
+                    if pin in PWM_PINS:
+                        self.apply(PWM_PINS[pin], "duty", int(fields[3]) / 65535.0)
+                elif kind == "A":
+                    reply(str(self.analog_read(int(fields[2]))))
+                elif kind == "Q":
+                    reply(" ".join(str(model.encoder_count()) for model in self.encoders()))
+                elif kind == "H":
+                    reply(" ".join("%d %d" % model.encoder_pins for model in self.encoders()))
+                elif kind == "X":
+                    break
+                else:
+                    raise RuntimeError("unknown event %r from %s" % (line, program))
+        finally:
+            proc.stdin.close()
+            proc.stdout.close()
+            status = proc.wait()
+        if status != 0:
+            raise RuntimeError("%s exited with status %d" % (program, status))
+        self.advance_to(until)
+        return self.rows
+
+    def metrics(self, settle_band=0.02):
+        """Return per-run figures: peaks, final positions and settling times.
+
+        A motor's settling time is the last sample time at which its speed
+        was outside settle_band of its peak speed around the final speed.
+        """
+        metrics = {}
+        for model in self.models:
+            metrics.update(model.metrics())
+            key = model.name() + "_rpm"
+            final = self.rows[-1][key]
+            band = max(settle_band * model.peak_omega * 60.0 / (2.0 * math.pi), 1e-3)
+            settle = 0.0
+            for row in self.rows:
+                if abs(row[key] - final) > band:
+                    settle = row["time_s"]
+            metrics[model.name() + "_settle_s"] = settle
+        return metrics
+
+
+def parse_channel(name):
+    name = name.strip().upper()
+    if name not in MOTORS:
+        raise argparse.ArgumentTypeError("unknown channel %r" % name)
+    return MOTORS.index(name)
+
+
+def parse_assignment(text):
+    name, _, value = text.partition("=")
+    if name not in DEFAULTS or not value:
+        raise argparse.ArgumentTypeError("expected NAME=VALUE with NAME one of %s" % ", ".join(DEFAULTS))
+    return name, value
+
+
+def build(args, params):
+    sim = ShieldSim(params, args.dt, args.every)
+    for channel in args.dc:
+        sim.attach_dc(parse_channel(channel))
+    for assignment in args.encoder:
+        channel, _, pins = assignment.partition("=")
+        pin_a, pin_b = (int(pin) for pin in pins.split(","))
+        sim.attach_encoder(parse_channel(channel), pin_a, pin_b)
+    for pair in args.stepper:
+        channel_a, channel_b = pair.split(",")
+        sim.attach_stepper(parse_channel(channel_a), parse_channel(channel_b))
+    return sim
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("logfile", nargs="?", help="serial log containing a trace dump")
+    parser.add_argument("--sketch", help="host-built sketch to run closed loop")
+    parser.add_argument("--dc", action="append", default=[])
+    parser.add_argument("--encoder", action="append", default=[])
+    parser.add_argument("--stepper", action="append", default=[])
+    parser.add_argument("--set", action="append", default=[], type=parse_assignment)
+    parser.add_argument("--sweep", type=parse_assignment)
+    parser.add_argument("--until", type=float, default=0.5)
+    parser.add_argument("--every", type=float, default=0.001)
+    parser.add_argument("--dt", type=float, default=50e-6)
+    args = parser.parse_args()
+
+    if not args.dc and not args.stepper:
+        parser.error("attach at least one motor with --dc or --stepper")
+    if (args.logfile is None) == (args.sketch is None):
+        parser.error("give either a logfile or --sketch")
+
+    changes = None
+    if args.logfile:
+        with open(args.logfile) as log:
+            changes = trace_decode.decode(log)
+    params = dict((name, float(value)) for name, value in args.set)
+
+    def simulate():
+        sim = build(args, params)
+        if changes is None:
+            sim.run_sketch(args.sketch, args.until)
+        else:
+            sim.run(changes, args.until)
+        return sim
+
+    if args.sweep:
+        name, values = args.sweep
+        for value in values.split(","):
+            params[name] = float(value)
+            metrics = simulate().metrics()
+            summary = " ".join("%s=%.6g" % (key, metrics[key]) for key in sorted(metrics))
+            print("%s=%s %s" % (name, value, summary))
+        return
+
+    rows = simulate().rows
+    keys = sorted(rows[0])
+    keys.remove("time_s")
+    keys.insert(0, "time_s")
+    out = sys.stdout
+    out.write(",".join(keys) + "\n")
+    for row in rows:
+        out.write(",".join("%.6g" % row[key] for key in keys) + "\n")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,95 @@
+// Exercises every enabled part of the library so extras/size_report.sh
+// measures what each feature switch costs.  Not meant to be run.
+#include <WickedMotorShield.h>
+
+#if WMS_ENABLE_STEPPER
+Wicked_Stepper probe_stepper(200, M1, M2);
+#endif
+#if WMS_ENABLE_DCMOTOR
+Wicked_DCMotor probe_dcmotor(M3);
+#endif
+#if WMS_ENABLE_DCMOTOR && WMS_ENABLE_RCIN
+Wicked_RCMixer probe_mixer(MIX_ARCADE);
+#endif
+
+volatile uint32_t sink;
+
+void setup(void){
+  WickedMotorShield::begin();
+#if WMS_ENABLE_STEPPER
+  probe_stepper.setSpeed(60);
+  probe_stepper.setDriveMode(STEP_HALF);
+  probe_stepper.setRunDuty(255);
+  probe_stepper.setAccelDuty(255, 4);
+  probe_stepper.setHoldDuty(127);
+  probe_stepper.setIdleTimeout(250, BRAKE_SOFT);
+#if WMS_ENABLE_CURRENT_SENSE
+  probe_stepper.setStallThreshold(100, 2);
+  sink = probe_stepper.home(-400);
+#endif
+#endif
+#if WMS_ENABLE_DCMOTOR
+  probe_dcmotor.setDirection(DIR_CW);
+  probe_dcmotor.setBrake(BRAKE_OFF);
+  probe_dcmotor.setSpeed(128);
+#if WMS_ENABLE_CURRENT_SENSE
+  probe_dcmotor.setOversampling(2);
+  WickedMotorShield::setSenseBudget(10000);
+#endif
+#if WMS_ENABLE_DCMOTOR && WMS_ENABLE_BEMF
+  probe_dcmotor.setBackEMF(A6, 256, 100);
+#endif
+#if WMS_ENABLE_PWM_CONFIG
+  sink = WickedMotorShield::setPWMFrequency(M2, 20000);
+  sink = WickedMotorShield::getPWMFrequency(M2);
+  sink = WickedMotorShield::getPWMResolution(M2);
+  probe_dcmotor.setSpeedFine(40000);
+#endif
+#endif
+#if WMS_ENABLE_DCMOTOR && WMS_ENABLE_RCIN
+  probe_mixer.attach(probe_dcmotor, MIX_LEFT);
+  probe_mixer.setCalibration(1500, 500, 20);
+  probe_mixer.setExpo(64);
+  probe_mixer.setFailsafe(100);
+#endif
+#if WMS_ENABLE_ENCODER
+  sink = probe_dcmotor.attachEncoder();
+  probe_dcmotor.setPosition(0);
+  probe_dcmotor.setPositionGain(24);
+  probe_dcmotor.moveTo(1000, 200);
+#endif
+}
+
+void loop(void){
+#if WMS_ENABLE_STEPPER
+  probe_stepper.step(1);
+  probe_stepper.update();
+#endif
+#if WMS_ENABLE_DCMOTOR && WMS_ENABLE_CURRENT_SENSE
+  sink = probe_dcmotor.currentSense();
+  sink = probe_dcmotor.getSampleRate();
+#endif
+#if WMS_ENABLE_DCMOTOR && WMS_ENABLE_BEMF
+  sink = probe_dcmotor.updateSpeedEstimate();
+  sink = probe_dcmotor.getSpeedEstimate();
+  sink = probe_dcmotor.getMeasurementOverhead();
+#endif
+#if WMS_ENABLE_RCIN
+  sink = WickedMotorShield::getRCIN(RCIN1, 25000);
+  sink = WickedMotorShield::getRCINWidth(RCIN2);
+#endif
+#if WMS_ENABLE_DCMOTOR && WMS_ENABLE_RCIN
+  sink = probe_mixer.update();
+  sink = probe_mixer.getCommand(MIX_RIGHT);
+#endif
+#if WMS_ENABLE_ENCODER
+  sink = probe_dcmotor.updatePosition();
+  sink = probe_dcmotor.isMoving();
+  sink = probe_dcmotor.getPosition();
+  sink = probe_dcmotor.getVelocity();
+#endif
+#if WMS_TRACE_DEPTH > 0
+  WickedMotorShield::dumpTrace(Serial);
+  WickedMotorShield::clearTrace();
+#endif
+}
@@ -0,0 +1,138 @@
+#!/bin/sh
+# Build the library in each feature configuration and report flash and RAM
+# use, per library symbol and per motor object.
+#
+# Usage: extras/size_report.sh [--calibrate] [fqbn]
+#
+# Needs arduino-cli with the AVR core installed.  The avr-size and avr-nm
+# from that core are found automatically, or set AVR_BIN to their
+# directory.  Each configuration builds extras/size_probe, which calls
+# every enabled part of the library, with the WMS_ feature switches passed
+# as compiler flags.  Exits with status 1 if a configuration fails to
+# build, is unknown, or exceeds its line in extras/size_budget.txt.  A
+# budget of "-" is not checked; see that file.
+#
+# --calibrate rewrites every budget in extras/size_budget.txt as the
+# measured size plus HEADROOM percent (default 5), rounded up to 16 bytes.
+# It only writes the file when every configuration built.
+
+CALIBRATE=0
+if [ "$1" = "--calibrate" ]; then
+  CALIBRATE=1
+  shift
+fi
+FQBN=${1:-arduino:avr:uno}
+HEADROOM=${HEADROOM:-5}
+EXTRAS=$(cd "$(dirname "$0")" && pwd)
+REPO=$(dirname "$EXTRAS")
+BUILD=${BUILD_DIR:-${TMPDIR:-/tmp}/wms_size_report}
+BUDGETS="$EXTRAS/size_budget.txt"
+
+FEATURES="STEPPER DCMOTOR RCIN CURRENT_SENSE BEMF PWM_CONFIG"
+
+# flags enabling only the named features, each switch defined once
+only() {
+  flags=""
+  for feature in $FEATURES; do
+    case " $* " in
+      *" $feature "*) flags="$flags -DWMS_ENABLE_$feature=1" ;;
+      *)              flags="$flags -DWMS_ENABLE_$feature=0" ;;
+    esac
+  done
+  echo "$flags"
+}
+
+config_flags() {
+  case "$1" in
+    all)             echo "" ;;
+    minimal)         only ;;
+    stepper)         only STEPPER ;;
+    stepper_current) only STEPPER CURRENT_SENSE ;;
+    dc)              only DCMOTOR ;;
+    dc_current)      only DCMOTOR CURRENT_SENSE ;;
+    dc_bemf)         only DCMOTOR BEMF ;;
+    dc_pwm)          only DCMOTOR PWM_CONFIG ;;
+    rc_mixer)        only DCMOTOR RCIN ;;
+    rc_capture)      echo "$(only DCMOTOR RCIN) -DWMS_RCIN_CAPTURE=1" ;;
+    encoder)         echo "$(only DCMOTOR RCIN) -DWMS_ENABLE_ENCODER=1" ;;
+    trace)           echo "-DWMS_TRACE_DEPTH=64" ;;
+    *)               echo "size_report: unknown configuration $1" >&2
+                     return 1 ;;
+  esac
+}
+
+# over budget check; a budget of "-" has not been calibrated yet
+over() {
+  [ "$2" != "-" ] && [ "$1" -gt "$2" ]
+}
+
+if ! command -v arduino-cli >/dev/null 2>&1; then
+  echo "size_report: arduino-cli not found" >&2
+  exit 2
+fi
+if [ -z "$AVR_BIN" ]; then
+  AVR_BIN=$(dirname "$(ls -d "$HOME"/.arduino15/packages/arduino/tools/avr-gcc/*/bin/avr-size 2>/dev/null | tail -n 1)")
+fi
+if [ ! -x "$AVR_BIN/avr-size" ] || [ ! -x "$AVR_BIN/avr-nm" ]; then
+  echo "size_report: avr-size/avr-nm not found, set AVR_BIN" >&2
+  exit 2
+fi
+
+status=0
+mkdir -p "$BUILD"
+rm -f "$BUILD/failed" "$BUILD/measured"
+printf "%-16s %8s %8s %8s %8s\n" config flash budget ram budget
+grep -v '^#' "$BUDGETS" | while read -r name flash_budget ram_budget; do
+  [ -n "$name" ] || continue
+  if ! flags=$(config_flags "$name"); then
+    echo 1 >"$BUILD/failed"
+    continue
+  fi
+  out="$BUILD/$name"
+  mkdir -p "$out"
+  if ! arduino-cli compile --fqbn "$FQBN" --library "$REPO" --build-path "$out" \
+      --build-property "compiler.cpp.extra_flags=$flags" \
+      "$EXTRAS/size_probe" >"$out/compile.log" 2>&1; then
+    echo "$name: build failed, see $out/compile.log" >&2
+    echo 1 >"$BUILD/failed"
+    continue
+  fi
+
+  elf="$out/size_probe.ino.elf"
+  # avr-size Berkeley format: text data bss dec hex filename
+  set -- $("$AVR_BIN/avr-size" "$elf" | tail -n 1)
+  flash=$(($1 + $2))
+  ram=$(($2 + $3))
+  mark=""
+  if over "$flash" "$flash_budget" || over "$ram" "$ram_budget"; then
+    mark="  OVER BUDGET"
+    echo 1 >"$BUILD/failed"
+  fi
+  printf "%-16s %8d %8s %8d %8s%s\n" "$name" "$flash" "$flash_budget" "$ram" "$ram_budget" "$mark"
+  echo "$name $flash $ram" >>"$BUILD/measured"
+
+  # per-symbol detail: library code and data, then the probe's motor
+  # objects; link time optimization may add a .lto_priv suffix
+  "$AVR_BIN/avr-nm" -C -S --size-sort "$elf" \
+    | grep -E 'WickedMotorShield|Wicked_|_step_sequence| probe_(stepper|dcmotor|mixer)(\.lto_priv\.[0-9]+)?$' \
+    | while read -r address size type symbol; do
+        printf "    %6d %s %s\n" "$((0x$size))" "$type" "$symbol"
+      done >"$out/symbols.txt"
+  cat "$out/symbols.txt"
+done
+
+if [ -f "$BUILD/failed" ]; then
+  rm -f "$BUILD/failed"
+  status=1
+elif [ $CALIBRATE -eq 1 ]; then
+  # measured sizes first, then the budget file with each line replaced
+  awk -v headroom="$HEADROOM" '
+      function budget(size) { size = int(size * (100 + headroom) / 100 + 15); return size - size % 16 }
+      FNR == NR { flash[$1] = $2; ram[$1] = $3; next }
+      /^#/ || NF == 0 || !($1 in flash) { print; next }
+      { printf "%-15s %5d %5d\n", $1, budget(flash[$1]), budget(ram[$1]) }' \
+    "$BUILD/measured" "$BUDGETS" >"$BUILD/size_budget.txt" \
+    && cp "$BUILD/size_budget.txt" "$BUDGETS" \
+    && echo "size_report: budgets written to $BUDGETS"
+fi
+exit $status
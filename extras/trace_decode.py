@@ -0,0 +1,142 @@
+#!/usr/bin/env python3
+"""Decode a Wicked Motor Shield trace dump into per-motor timelines.
+
+The dump is the text printed by WickedMotorShield::dumpTrace(); it may be
+embedded in a longer serial log.  Its header line gives the format version
+and, from version 2, the length of a time stamp unit in nanoseconds (4000,
+one Timer0 count, on a 16 MHz board, or 1000 once setPWMFrequency() has
+taken over Timer0); version 1 dumps used micros().  Each
+event line holds the time stamp, the event type and two data bytes, all in
+hexadecimal:
+
+    S <first_shift_register> <second_shift_register>   shift register load
+    P <motor_number> <duty>                            PWM duty change
+
+Usage:
+    trace_decode.py [--csv] [logfile]
+
+Without a file name the log is read from standard input.  The decoded
+changes are printed as a timeline, or as CSV with --csv.  Other tools can
+import decode() to replay the outputs.
+"""
+
+import argparse
+import sys
+
+MOTORS = ("M1", "M2", "M3", "M4", "M5", "M6")
+
+# (shift register index, direction mask, brake mask) for M1..M6,
+# matching the Mx_DIR_MASK / Mx_BRAKE_MASK values in WickedMotorShield.h
+MOTOR_BITS = (
+    (0, 0x20, 0x10),
+    (0, 0x08, 0x04),
+    (0, 0x02, 0x01),
+    (0, 0x80, 0x40),
+    (1, 0x20, 0x10),
+    (1, 0x80, 0x40),
+)
+
+
+def bridge_state(registers, motor):
+    """Return CW, CCW, BRAKE_HARD or BRAKE_SOFT for one motor."""
+    reg, dir_mask, brake_mask = MOTOR_BITS[motor]
+    value = registers[reg]
+    if value & brake_mask:
+        return "BRAKE_HARD" if value & dir_mask else "BRAKE_SOFT"
+    return "CW" if value & dir_mask else "CCW"
+
+
+def parse_events(lines):
+    """Yield (time_us, type, data0, data1) for every event in the dump.
+
+    The 32-bit time stamps wrap, every 4.8 hours with 4 us units; they are
+    unwrapped so they increase monotonically from the first event.
+    """
+    in_dump = False
+    offset = 0
+    last = None
+    tick_us = 1.0
+    for line in lines:
+        line = line.strip()
+        if line.startswith("# wms-trace"):
+            header = line.split()
+            version = int(header[2]) if len(header) > 2 else 1
+            if version == 1:
+                tick_us = 1.0
+            elif version == 2 and len(header) > 3:
+                tick_us = int(header[3]) / 1000.0
+            else:
+                raise ValueError("unsupported trace header: %r" % line)
+            in_dump = True
+            offset = 0
+            last = None
+            continue
+        if line.startswith("# end"):
+            in_dump = False
+            continue
+        if not in_dump or not line:
+            continue
+        fields = line.split()
+        if len(fields) != 4:
+            raise ValueError("bad trace line: %r" % line)
+        time = int(fields[0], 16)
+        if last is not None and time < last:
+            offset += 1 << 32
+        last = time
+        yield (time + offset) * tick_us, fields[1], int(fields[2], 16), int(fields[3], 16)
+
+
+def decode(lines):
+    """Return a list of (time_us, motor, field, value) changes.
+
+    field is "bridge" (value CW, CCW, BRAKE_HARD or BRAKE_SOFT) or "pwm"
+    (value 0..255).  Times are relative to the first event.  Only changes
+    are reported, except that the first shift register load reports every
+    motor.
+    """
+    changes = []
+    bridges = [None] * len(MOTORS)
+    start = None
+    for time, kind, data0, data1 in parse_events(lines):
+        if start is None:
+            start = time
+        time -= start
+        if kind == "S":
+            registers = (data0, data1)
+            for motor in range(len(MOTORS)):
+                state = bridge_state(registers, motor)
+                if state != bridges[motor]:
+                    bridges[motor] = state
+                    changes.append((time, motor, "bridge", state))
+        elif kind == "P":
+            if data0 < len(MOTORS):
+                changes.append((time, data0, "pwm", data1))
+        else:
+            raise ValueError("unknown trace event type %r" % kind)
+    return changes
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("logfile", nargs="?", help="serial log containing the dump")
+    parser.add_argument("--csv", action="store_true", help="print CSV instead of a timeline")
+    args = parser.parse_args()
+
+    if args.logfile:
+        with open(args.logfile) as log:
+            changes = decode(log)
+    else:
+        changes = decode(sys.stdin)
+
+    if args.csv:
+        print("time_us,motor,field,value")
+        for time, motor, field, value in changes:
+            print("%d,%s,%s,%s" % (time, MOTORS[motor], field, value))
+        return
+
+    for time, motor, field, value in changes:
+        print("%12.3f ms  %s  %-6s %s" % (time / 1000.0, MOTORS[motor], field, value))
+
+
+if __name__ == "__main__":
+    main()